@@ -4,6 +4,9 @@
 
 #pragma once
 
+#include <pa_utils.h> // for Press
+#include <plankton_typed.h>
+
 #include <cstdint>
 
 // Common Types
@@ -13,11 +16,85 @@ enum class Intent : uint8_t {
     START_MANU,
     START_AUTO,
     QUIT,
+    CALIBRATE,
+};
+
+struct Speed {
+    int8_t x;
+    int8_t y;
 };
 
+// A speed received longer ago than this many ms is stale - the remote repeats a speed other than zero well within.
+constexpr uint32_t MAX_JOYSTICK_AGE = 300;
+
+// Filtered ranges of all sensors of the ranger taken in one cycle, ordered from left to right - the middle one
+// looks straight ahead. Each comes with the percentage of recent ranges agreeing with it and its change in mm/s.
+// Unused slots are zero. The age tells how many ms before publishing the oldest of the ranges got captured.
+constexpr uint8_t MAX_RANGES = 5;
+
+struct Ranges {
+    uint8_t count;
+    uint8_t confidence[MAX_RANGES];
+    uint16_t mm[MAX_RANGES];
+    int16_t rate[MAX_RANGES];
+    uint16_t age;
+};
+
+// Ranges with a lower confidence are no better than none.
+constexpr uint8_t MIN_RANGE_CONFIDENCE = 40;
+
+// The range straight ahead - 0 if there is none to trust.
+inline uint16_t frontRange(const Ranges& ranges) {
+    if (ranges.count == 0 || ranges.count > MAX_RANGES) {
+        return 0;
+    }
+    const auto front = ranges.count / 2;
+    return ranges.confidence[front] >= MIN_RANGE_CONFIDENCE ? ranges.mm[front] : 0;
+}
+
+// The change of the range straight ahead in mm/s - negative while approaching, 0 if there is no range to trust.
+inline int16_t frontRate(const Ranges& ranges) {
+    return frontRange(ranges) != 0 ? ranges.rate[ranges.count / 2] : 0;
+}
+
+// A subscriber only keeps the last sample of a topic - so each node publishes its diagnostics on topics of its own.
 enum Topic : uint32_t {
     RANGE = 52,
     JOYSTICK = 53,
     INTENT = 54,
     PRESS = 55,
+    MOTION_DIAGNOSTICS = 56,
+    MOTION_TICKS = 57,
+    RANGER_DIAGNOSTICS = 58,
+    RANGER_TICKS = 59,
+    REMOTE_TICKS = 60,
+};
+
+// Multicast channel bundling the topics the motion node subscribes to.
+constexpr uint8_t MOTION_CHANNEL = 1;
+
+// The nodes as named in the header of their recordings when built with EGO_RECORD.
+enum RecordNode : uint8_t {
+    MOTION_NODE = 0,
+    RANGER_NODE = 1,
+    REMOTE_NODE = 2,
 };
+
+// Tags of the raw values the nodes record next to their datagrams when built with EGO_RECORD.
+enum RecordTag : uint8_t {
+    RAW_RANGES = 1,   // The RangeSample of all sensors of a cycle, from left to right - 8 bytes each, as laid out
+                      // on the ESP32: the 16 bit range, 2 bytes of padding and the 32 bit capture time.
+    RAW_JOYSTICK = 2, // The int8 x and y and a byte which is 1 while the button is pressed, as read each tick.
+};
+
+// Typed Topics
+
+using RangeTopic = TypedTopic<Topic::RANGE, Ranges>;
+using JoystickTopic = TypedTopic<Topic::JOYSTICK, Speed>;
+using IntentTopic = TypedTopic<Topic::INTENT, Intent>;
+using PressTopic = TypedTopic<Topic::PRESS, Press>;
+using MotionDiagnosticsTopic = TypedTopic<Topic::MOTION_DIAGNOSTICS, Plankton::Stats>;
+using MotionTicksTopic = TypedTopic<Topic::MOTION_TICKS, TickStats>;
+using RangerDiagnosticsTopic = TypedTopic<Topic::RANGER_DIAGNOSTICS, Plankton::Stats>;
+using RangerTicksTopic = TypedTopic<Topic::RANGER_TICKS, TickStats>;
+using RemoteTicksTopic = TypedTopic<Topic::REMOTE_TICKS, TickStats>;
@@ -2,7 +2,35 @@
 
 #include "pa_plankton.h"
 
-Plankton plankton;
+#if defined(PLANKTON_NET_CORE) && !defined(EGO_SIM)
+#include <plankton_task.h>
+#elif !defined(EGO_SIM)
+#include <plankton_socket.h>
+#endif
+
+#include <WiFi.h>
+
+#if defined(EGO_SIM)
+LoopbackBus simBus;
+static LoopbackTransport transport{simBus};
+#elif defined(PLANKTON_NET_CORE)
+// The socket is served by a task on the given core while the tick loop only exchanges datagrams with it.
+static SocketTransport socketTransport;
+static TaskTransport transport{socketTransport, PLANKTON_NET_CORE};
+#else
+static SocketTransport transport;
+#endif
+
+#ifdef EGO_RECORD
+InputRecorder inputRecorder;
+static RecordingTransport recordingTransport{transport, inputRecorder};
+Plankton plankton{recordingTransport};
+#else
+Plankton plankton{transport};
+#endif
+
+// Bounds the time spent receiving within a tick even when the LAN gets flooded.
+static constexpr auto receiveBudget = Plankton::PollBudget{16, 5000};
 
 pa_activity_def (Connector) {
     Serial.println("Connectecing to WLAN...");  
@@ -18,6 +46,137 @@ pa_activity_def (Connector) {
 
 pa_activity_def (Receiver) {
     pa_always {
-        plankton.poll();
+        auto morePending = false;
+        plankton.poll(receiveBudget, morePending);
     } pa_always_end;
 } pa_end;
+
+// Input Wakeup
+
+#if defined(EGO_SIM)
+
+bool startInputWakeup(std::initializer_list<uint32_t> /*topics*/, TickType_t /*minPeriod*/) {
+    return false;
+}
+
+TickType_t waitForNextTick(TickType_t& prevWakeTime, TickType_t period) {
+    vTaskDelayUntil(&prevWakeTime, period);
+    return period;
+}
+
+#else
+
+static constexpr size_t maxWakeupTopics = 4;
+
+static struct {
+    TaskHandle_t tickTask;
+    TaskHandle_t watcherTask;
+    uint32_t topics[maxWakeupTopics];
+    uint32_t counts[maxWakeupTopics];
+    size_t numTopics;
+    TickType_t minPeriod;
+} wakeup;
+
+#if defined(PLANKTON_NET_CORE)
+
+// The network task queues the datagrams and notifies the tick loop right away.
+static bool startNotifier() {
+    transport.notifyOnReceive(wakeup.tickTask);
+    return true;
+}
+
+static void notifierDrained() {}
+
+#else
+
+// Notifies the tick loop whenever a datagram is pending and then waits until the loop drained the socket.
+static void inputWatcher(void*) {
+    while (true) {
+        if (!transport.isConnected()) {
+            vTaskDelay(100);
+            continue;
+        }
+        if (transport.wait(1000)) {
+            xTaskNotifyGive(wakeup.tickTask);
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        }
+    }
+}
+
+static bool startNotifier() {
+    return xTaskCreate(inputWatcher, "inputWatcher", 2048, nullptr, 2, &wakeup.watcherTask) == pdPASS;
+}
+
+static void notifierDrained() {
+    xTaskNotifyGive(wakeup.watcherTask);
+}
+
+#endif
+
+bool startInputWakeup(std::initializer_list<uint32_t> topics, TickType_t minPeriod) {
+    if (wakeup.tickTask != nullptr || topics.size() > maxWakeupTopics) {
+        return false;
+    }
+    for (const auto topic : topics) {
+        wakeup.topics[wakeup.numTopics++] = topic;
+    }
+    wakeup.minPeriod = minPeriod;
+    wakeup.tickTask = xTaskGetCurrentTaskHandle();
+    if (!startNotifier()) {
+        wakeup.tickTask = nullptr;
+        wakeup.numTopics = 0;
+        return false;
+    }
+    return true;
+}
+
+// Tells whether one of the wakeup topics got a new sample since the last call.
+static bool checkWakeupTopics() {
+    auto woken = false;
+    for (size_t i = 0; i < wakeup.numTopics; ++i) {
+        auto info = Plankton::SampleInfo{};
+        if (plankton.describe(wakeup.topics[i], info) && info.count != wakeup.counts[i]) {
+            wakeup.counts[i] = info.count;
+            woken = true;
+        }
+    }
+    return woken;
+}
+
+TickType_t waitForNextTick(TickType_t& prevWakeTime, TickType_t period) {
+    if (wakeup.tickTask == nullptr) {
+        vTaskDelayUntil(&prevWakeTime, period);
+        return period;
+    }
+
+    // Samples which arrived before the tick just run have been seen by it.
+    checkWakeupTopics();
+
+    const auto start = prevWakeTime;
+    const auto deadline = start + period;
+    while (true) {
+        auto morePending = false;
+        plankton.poll(receiveBudget, morePending);
+        if (checkWakeupTopics()) {
+            auto now = xTaskGetTickCount();
+            if (TickType_t(now - start) < wakeup.minPeriod) {
+                vTaskDelay(start + wakeup.minPeriod - now);
+                now = start + wakeup.minPeriod;
+            }
+            if (TickType_t(now - start) < period) {
+                prevWakeTime = now;
+                return now - start;
+            }
+        }
+        notifierDrained();
+
+        // Whatever did not fit into the budget gets received right away - the deadline still bounds the wait.
+        const auto remaining = TickType_t(deadline - xTaskGetTickCount());
+        if (remaining == 0 || remaining > period || (!morePending && ulTaskNotifyTake(pdTRUE, remaining) == 0)) {
+            prevWakeTime = deadline;
+            return period;
+        }
+    }
+}
+
+#endif
@@ -6,9 +6,62 @@
 
 #include <proto_activities.h>
 #include <plankton.h>
+#include <plankton_typed.h>
 
+#include <Arduino.h>
+
+#include <initializer_list>
+
+/// Build with `PLANKTON_NET_CORE` set to a core number to do the socket I/O in a task pinned to that core.
 extern Plankton plankton;
 
+#ifdef EGO_RECORD
+#include <pa_record.h>
+
+/// With `EGO_RECORD` defined, all datagrams the global Plankton receives are recorded here.
+/// Nothing gets recorded until the recorder is begun with a sink.
+extern InputRecorder inputRecorder;
+#endif
+
+#ifdef EGO_SIM
+#include <plankton_loopback.h>
+
+/// In the host simulation the global Plankton talks over this bus to the nodes of the driver.
+extern LoopbackBus simBus;
+#endif
+
 pa_activity_decl (Connector, pa_ctx());
 
 pa_activity_decl (Receiver, pa_ctx());
+
+pa_activity_ctx (TopicPublisher, unsigned ticks);
+
+/// Multicasts `value` on a `TypedTopic` every `period` ticks - the first time right away.
+/// Pass the topic as a value, like `RangerTicksTopic{}`, for its type to get deduced - the topic then checks
+/// the size and layout of `value` at compile time.
+template <typename TopicT>
+pa_activity_def (TopicPublisher, TopicT, const typename TopicT::Type& value, unsigned period) {
+    TopicT::advertise(plankton, {false, true, 0, false});
+    while (true) {
+        TopicT::publish(plankton, value);
+        pa_self.ticks = period;
+        while (pa_self.ticks > 0) {
+            pa_pause;
+            pa_self.ticks -= 1;
+        }
+    }
+} pa_end;
+
+// Input Wakeup
+
+/// Lets `waitForNextTick` end the wait early when one of the given topics gets a new sample - a datagram
+/// arriving notifies the waiting task, either from the network task of `PLANKTON_NET_CORE` or from a watcher
+/// task blocking on the socket. Input ticks are spaced at least `minPeriod` apart from the previous tick.
+/// Call this from `setup()` as the tick loop is the task which gets notified. Not supported in the host
+/// simulation, whose driver ticks on its own.
+bool startInputWakeup(std::initializer_list<uint32_t> topics, TickType_t minPeriod);
+
+/// Waits like `vTaskDelayUntil` for the next tick `period` after `prevWakeTime` - receiving meanwhile if input
+/// wakeup got started, in which case it returns as soon as a wakeup topic arrives and restarts the period from
+/// there. Returns the time since the previous wake - less than `period` for an input tick.
+TickType_t waitForNextTick(TickType_t& prevWakeTime, TickType_t period);
@@ -4,13 +4,212 @@
 
 #include <VL53L0X.h>
 
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+#include <freertos/task.h>
+
+#include <atomic>
+
+#ifndef PA_RANGING_QUEUE_DEPTH
+#define PA_RANGING_QUEUE_DEPTH 4
+#endif
+
+#ifndef PA_RANGING_TASK_STACK
+#define PA_RANGING_TASK_STACK 2048
+#endif
+
 // State
 
-static VL53L0X sensor;
+static VL53L0X sensors[PA_RANGING_MAX_SENSORS];
+static size_t numSensors = 1;
+static bool arrayMode = false;
+
+// Without an array, all ranging is done with the first sensor.
+static VL53L0X& sensor = sensors[0];
+
+// Profiles
+
+struct ProfileConfig {
+    float signalRateLimit;      // MCPS
+    uint8_t preRangePclks;
+    uint8_t finalRangePclks;
+    uint32_t timingBudget;      // us
+    uint32_t period;            // ms
+};
+
+// As in the examples of the Pololu library.
+static const ProfileConfig profileConfigs[] = {
+    {0.25f, 14, 10, 33000, 100},    // DEFAULT
+    {0.25f, 14, 10, 20000, 25},     // HIGH_SPEED
+    {0.25f, 14, 10, 200000, 220},   // HIGH_ACCURACY
+    {0.1f, 18, 14, 33000, 50},      // LONG_RANGE
+};
+
+static RangingProfile activeProfile = RangingProfile::DEFAULT;
+static std::atomic<uint8_t> wantedProfile{uint8_t(RangingProfile::DEFAULT)};
+
+uint32_t rangingPeriod(RangingProfile profile) {
+    return profileConfigs[size_t(profile)].period;
+}
+
+static bool applyProfile(RangingProfile profile) {
+    const auto& config = profileConfigs[size_t(profile)];
+    for (size_t i = 0; i < numSensors; ++i) {
+        auto& device = sensors[i];
+        if (!device.setSignalRateLimit(config.signalRateLimit) ||
+            !device.setVcselPulsePeriod(VL53L0X::VcselPeriodPreRange, config.preRangePclks) ||
+            !device.setVcselPulsePeriod(VL53L0X::VcselPeriodFinalRange, config.finalRangePclks) ||
+            !device.setMeasurementTimingBudget(config.timingBudget)) {
+            return false;
+        }
+        // Only the ranging task waits for a range - give it until the one after the next is due.
+        device.setTimeout(uint16_t(2 * config.period));
+    }
+    activeProfile = profile;
+    return true;
+}
+
+// Set when the sensors of an array got stopped to switch the profile - `RangerArray` restarts them staggered.
+static bool arrayRestart = false;
+
+/// Switches to the wanted profile if it changed - restarting the measurements if they run.
+static void updateProfile(bool running) {
+    const auto profile = RangingProfile(wantedProfile.load());
+    if (profile == activeProfile) {
+        return;
+    }
+    if (running) {
+        for (size_t i = 0; i < numSensors; ++i) {
+            sensors[i].stopContinuous();
+        }
+    }
+    if (!applyProfile(profile)) {
+        Serial.println("Ranging profile failed");
+        applyProfile(activeProfile);
+    }
+    if (running) {
+        if (arrayMode) {
+            arrayRestart = true;
+        } else {
+            sensor.startContinuous(rangingPeriod(activeProfile));
+        }
+    }
+}
+
+// Data-Ready Interrupt
+//
+// The interrupt only takes the time and wakes the ranging task which owns the sensor from then on -
+// it reads the range, clears the interrupt on the sensor and queues the sample for the tick.
+
+static constexpr uint32_t DATA_READY = 1 << 0;
+static constexpr uint32_t CONTROL = 1 << 1;
 
-// Functions 
+static TaskHandle_t rangingTask = nullptr;
+static QueueHandle_t sampleQueue = nullptr;
+static std::atomic<bool> rangingWanted{false};
+static volatile uint32_t readyTime;
 
-bool initRanging(int sda, int scl) {
+static void IRAM_ATTR onDataReady() {
+    readyTime = millis();
+    auto woken = BaseType_t{pdFALSE};
+    xTaskNotifyFromISR(rangingTask, DATA_READY, eSetBits, &woken);
+    if (woken == pdTRUE) {
+        portYIELD_FROM_ISR();
+    }
+}
+
+static void queueSample(const RangeSample& sample) {
+    // The tick wants the latest sample, so make room by dropping the oldest.
+    if (xQueueSend(sampleQueue, &sample, 0) != pdTRUE) {
+        RangeSample oldest;
+        xQueueReceive(sampleQueue, &oldest, 0);
+        xQueueSend(sampleQueue, &sample, 0);
+    }
+}
+
+static void runRanging(void*) {
+    auto running = false;
+    while (true) {
+        auto bits = uint32_t{};
+        const auto timeout = pdMS_TO_TICKS(2 * rangingPeriod(activeProfile));
+        const auto notified = xTaskNotifyWait(0, UINT32_MAX, &bits, timeout) == pdTRUE;
+
+        const auto wanted = rangingWanted.load();
+        if (wanted != running) {
+            if (wanted) {
+                updateProfile(false);
+                sensor.startContinuous(rangingPeriod(activeProfile));
+            } else {
+                sensor.stopContinuous();
+            }
+            running = wanted;
+            continue;
+        }
+        if (notified && (bits & CONTROL) != 0) {
+            updateProfile(running);
+        }
+        if (!running || (notified && (bits & DATA_READY) == 0)) {
+            continue;
+        }
+        // Without an interrupt in time, poll once - this also recovers from a missed edge.
+        const auto captureTime = notified ? readyTime : millis();
+        auto range = sensor.readRangeContinuousMillimeters();
+        if (sensor.timeoutOccurred()) {
+            range = UNDEF_RANGE;
+        }
+        queueSample(RangeSample{range, captureTime});
+    }
+}
+
+static bool initDataReady(int intPin) {
+    sampleQueue = xQueueCreate(PA_RANGING_QUEUE_DEPTH, sizeof(RangeSample));
+    if (sampleQueue == nullptr) {
+        return false;
+    }
+    // Runs next to the tick loop on the same core but preempts it to fetch a range right away.
+    if (xTaskCreatePinnedToCore(runRanging, "ranging", PA_RANGING_TASK_STACK, nullptr, 2, &rangingTask, 1) != pdPASS) {
+        return false;
+    }
+    // The sensor drives GPIO1 low when a range is ready - as configured by `VL53L0X::init`.
+    pinMode(intPin, INPUT_PULLUP);
+    attachInterrupt(digitalPinToInterrupt(intPin), onDataReady, FALLING);
+    return true;
+}
+
+static void controlRanging(bool wanted) {
+    rangingWanted = wanted;
+    xTaskNotify(rangingTask, CONTROL, eSetBits);
+}
+
+// Polling
+//
+// Without the interrupt, the tick asks the sensor whether a range is ready and only then reads it.
+
+static bool polling = false;
+static uint32_t lastPollTime;
+
+static bool rangeReady(VL53L0X& device) {
+    return (device.readReg(VL53L0X::RESULT_INTERRUPT_STATUS) & 0x07) != 0;
+}
+
+static bool pollSample(RangeSample& sample) {
+    const auto now = millis();
+    if (rangeReady(sensor)) {
+        const auto range = sensor.readRangeContinuousMillimeters();
+        sample.range = sensor.timeoutOccurred() ? UNDEF_RANGE : range;
+    } else if (now - lastPollTime >= 2 * rangingPeriod(activeProfile)) {
+        sample.range = UNDEF_RANGE;
+    } else {
+        return false;
+    }
+    sample.captureTime = now;
+    lastPollTime = now;
+    return true;
+}
+
+// Functions
+
+bool initRanging(int sda, int scl, int intPin, RangingProfile profile) {
     if (!Wire.begin(sda, scl, 100000)) {
         Serial.println("Wire init failed");
         return false;
@@ -19,35 +218,175 @@ bool initRanging(int sda, int scl) {
         Serial.println("Sensor init failed");
         return false;
     }
+    if (!applyProfile(profile)) {
+        Serial.println("Ranging profile failed");
+        return false;
+    }
+    wantedProfile = uint8_t(profile);
+    if (intPin >= 0 && !initDataReady(intPin)) {
+        Serial.println("Data-ready init failed");
+        return false;
+    }
+    return true;
+}
+
+bool initRangingArray(int sda, int scl, const int* xshutPins, size_t count, RangingProfile profile) {
+    if (count == 0 || count > PA_RANGING_MAX_SENSORS) {
+        Serial.println("Invalid number of sensors");
+        return false;
+    }
+    if (!Wire.begin(sda, scl, 100000)) {
+        Serial.println("Wire init failed");
+        return false;
+    }
+    // All sensors come up on the same default address, so only one may be out of reset at a time.
+    for (size_t i = 0; i < count; ++i) {
+        pinMode(xshutPins[i], OUTPUT);
+        digitalWrite(xshutPins[i], LOW);
+    }
+    delay(10);
+    for (size_t i = 0; i < count; ++i) {
+        // Released, XSHUT gets pulled up by the breakout - the sensor boots within 2 ms.
+        pinMode(xshutPins[i], INPUT);
+        delay(10);
+        if (!sensors[i].init()) {
+            Serial.printf("Sensor %u init failed\n", unsigned(i));
+            return false;
+        }
+        sensors[i].setAddress(uint8_t(PA_RANGING_FIRST_ADDRESS + i));
+    }
+    numSensors = count;
+    arrayMode = true;
+    if (!applyProfile(profile)) {
+        Serial.println("Ranging profile failed");
+        return false;
+    }
+    wantedProfile = uint8_t(profile);
     return true;
 }
 
+size_t rangingSensors() {
+    return numSensors;
+}
+
+void setRangingProfile(RangingProfile profile) {
+    wantedProfile = uint8_t(profile);
+    if (rangingTask != nullptr) {
+        xTaskNotify(rangingTask, CONTROL, eSetBits);
+        return;
+    }
+    updateProfile(polling);
+    lastPollTime = millis();
+}
+
+RangingProfile rangingProfile() {
+    return RangingProfile(wantedProfile.load());
+}
+
 static void startRanging(void)
 {
-    sensor.startContinuous(100);
-    sensor.setTimeout(50);
+    if (rangingTask != nullptr) {
+        xQueueReset(sampleQueue);
+        controlRanging(true);
+        return;
+    }
+    sensor.startContinuous(rangingPeriod(activeProfile));
+    polling = true;
+    lastPollTime = millis();
 }
 
-static uint16_t measureRange(void)
+static bool fetchSample(RangeSample& sample)
 {
-    const auto range = sensor.readRangeContinuousMillimeters();
-    if (sensor.timeoutOccurred())
-    {
-        return UNDEF_RANGE;
+    if (rangingTask != nullptr) {
+        auto fetched = false;
+        while (xQueueReceive(sampleQueue, &sample, 0) == pdTRUE) {
+            fetched = true;
+        }
+        return fetched;
     }
-    return range;
+    return pollSample(sample);
 }
 
 void stopRanging(void)
 {
-    sensor.stopContinuous();
+    if (rangingTask != nullptr) {
+        controlRanging(false);
+        return;
+    }
+    for (size_t i = 0; i < numSensors; ++i) {
+        sensors[i].stopContinuous();
+    }
+    polling = false;
 }
 
 // Activities
 
-pa_activity_def (Ranger, uint16_t& range) {
-    startRanging();
+/// Reads the samples which are ready and tells whether the cycle is complete.
+static bool pollArray(RangeSample* samples, uint8_t& fresh, uint32_t& cycleStart) {
+    const auto now = millis();
+    for (size_t i = 0; i < numSensors; ++i) {
+        if (rangeReady(sensors[i])) {
+            const auto range = sensors[i].readRangeContinuousMillimeters();
+            samples[i] = RangeSample{sensors[i].timeoutOccurred() ? UNDEF_RANGE : range, now};
+            fresh |= 1 << i;
+        }
+    }
+    const uint8_t all = (1 << numSensors) - 1;
+    if (fresh != all && now - cycleStart < 2 * rangingPeriod(activeProfile)) {
+        return false;
+    }
+    for (size_t i = 0; i < numSensors; ++i) {
+        if ((fresh & (1 << i)) == 0) {
+            samples[i] = RangeSample{UNDEF_RANGE, now};
+        }
+    }
+    fresh = 0;
+    cycleStart = now;
+    return true;
+}
+
+pa_activity_def (RangerArray, RangeSample* samples, bool& cycle) {
+    for (size_t i = 0; i < numSensors; ++i) {
+        samples[i] = RangeSample{UNDEF_RANGE, millis()};
+    }
+    cycle = false;
+
+    if (!arrayMode) {
+        startRanging();
+        pa_always {
+            cycle = fetchSample(samples[0]);
+        } pa_always_end;
+    }
+
+    polling = true;
+    arrayRestart = false;
+    while (true) {
+        // Staggered by a tick, the sensors do not see the pulses of each other.
+        for (pa_self.started = 0; pa_self.started < numSensors; ++pa_self.started) {
+            sensors[pa_self.started].startContinuous(rangingPeriod(activeProfile));
+            cycle = false;
+            pa_pause;
+        }
+        pa_self.fresh = 0;
+        pa_self.cycleStart = millis();
+        while (!arrayRestart) {
+            cycle = pollArray(samples, pa_self.fresh, pa_self.cycleStart);
+            pa_pause;
+        }
+        arrayRestart = false;
+    }
+} pa_end;
+
+pa_activity_def (RangeFilters, const RangeSample* samples, bool cycle, FilteredRange* filtered) {
+    for (size_t i = 0; i < numSensors; ++i) {
+        pa_self.filters[i].reset();
+        filtered[i] = pa_self.filters[i].value();
+    }
     pa_always {
-        range = measureRange();
+        if (cycle) {
+            for (size_t i = 0; i < numSensors; ++i) {
+                filtered[i] = pa_self.filters[i].update(samples[i].range, samples[i].captureTime);
+            }
+        }
     } pa_always_end;
 } pa_end;
@@ -4,20 +4,73 @@
 
 #pragma once
 
+#include "range_filter.h"
+
 #include <proto_activities.h>
 
+#include <cstddef>
 #include <cstdint>
 
 // Constants
 
-constexpr uint16_t UNDEF_RANGE = ((1 << 16) - 1);
+#ifndef PA_RANGING_MAX_SENSORS
+#define PA_RANGING_MAX_SENSORS 5
+#endif
+
+/// The address of the first sensor of an array - the others follow on the next addresses.
+#ifndef PA_RANGING_FIRST_ADDRESS
+#define PA_RANGING_FIRST_ADDRESS 0x30
+#endif
+
+// Types
+
+/// A range with the time in ms the sensor had it ready - exact to the interrupt when ranging on data-ready.
+struct RangeSample {
+    uint16_t range;
+    uint32_t captureTime;
+};
+
+/// Trades the rate of the ranges against their precision and reach.
+enum class RangingProfile : uint8_t {
+    DEFAULT,        ///< 33 ms timing budget, a range every 100 ms.
+    HIGH_SPEED,     ///< 20 ms timing budget, a range every 25 ms - less accurate.
+    HIGH_ACCURACY,  ///< 200 ms timing budget, a range every 220 ms.
+    LONG_RANGE      ///< Lower signal limit and longer laser pulses to see up to 2 m in the dark, a range every 50 ms.
+};
 
 // Functions
 
-bool initRanging(int sda, int scl);
+/// With `intPin` set to the pin GPIO1 of the sensor is wired to, a task fetches each range as soon as the
+/// sensor signals it is ready and queues it for the `RangerArray` - so the tick never waits on the sensor.
+/// With -1, the `RangerArray` polls the sensor from the tick whether a range is ready.
+bool initRanging(int sda, int scl, int intPin = -1, RangingProfile profile = RangingProfile::DEFAULT);
+
+/// Brings up a sensor per XSHUT pin on one bus - all get held in reset first, then each gets woken on its own
+/// and moved to an address of its own. Arrays always poll the sensors from the tick.
+bool initRangingArray(int sda, int scl, const int* xshutPins, size_t count, RangingProfile profile = RangingProfile::DEFAULT);
+
+/// Number of sensors - 1 unless an array got set up.
+size_t rangingSensors();
+
+/// Switches the profile - while ranging, this restarts the measurements and costs about one range.
+void setRangingProfile(RangingProfile profile);
+RangingProfile rangingProfile();
+
+/// Milliseconds between two ranges with the profile.
+uint32_t rangingPeriod(RangingProfile profile);
 
 void stopRanging();
 
 // Activities
 
-pa_activity_decl (Ranger, pa_ctx(), uint16_t& range);
+/// Provides the latest sample of each of the `rangingSensors` in `samples` and sets `cycle` on the tick all of
+/// them delivered a fresh one - or two periods passed, in which case the missing ones are `UNDEF_RANGE`.
+/// A single sensor set up by `initRanging` delivers a cycle with each of its samples.
+/// The sensors of an array get started a tick apart so that they do not measure at the same time. Polled from
+/// the tick, they capture their ranges at the tick which finds them ready.
+pa_activity_decl (RangerArray, pa_ctx(uint8_t started; uint8_t fresh; uint32_t cycleStart), RangeSample* samples, bool& cycle);
+
+/// Runs a `RangeFilter` per sensor over the samples of `RangerArray` and updates `filtered` on each cycle -
+/// the rates are over the capture times of the samples.
+pa_activity_decl (RangeFilters, pa_ctx(RangeFilter filters[PA_RANGING_MAX_SENSORS]),
+                                const RangeSample* samples, bool cycle, FilteredRange* filtered);
@@ -0,0 +1,108 @@
+// range_filter
+//
+// Copyright (c) 2022, Framework Labs.
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+
+/// Reported for a range the sensor did not deliver in time.
+constexpr uint16_t UNDEF_RANGE = ((1 << 16) - 1);
+
+#ifndef RANGE_FILTER_WINDOW
+#define RANGE_FILTER_WINDOW 5
+#endif
+
+/// A range after filtering.
+struct FilteredRange {
+    uint16_t range;         ///< Median of the window - `UNDEF_RANGE` while the confidence is 0.
+    int16_t rate;           ///< Change in mm/s - negative while approaching.
+    uint8_t confidence;     ///< Percentage of the window which is valid and agrees with the median.
+    uint32_t captureTime;   ///< Time in ms of the latest range - as passed to `update`.
+};
+
+/// Filters the ranges of a sensor with a running median and tells how far to trust the result.
+///
+/// The median of the window ignores single spikes - and up to half the window of them in a row - so
+/// thresholds on the range do not flip back and forth. Ranges which are missing or far off the median
+/// lower the confidence instead. The rate is the smoothed change of the median over time.
+/// Plain C++ without Arduino so that it runs on the host too.
+class RangeFilter {
+public:
+    static constexpr size_t window = RANGE_FILTER_WINDOW;
+
+    /// Ranges deviating more than this - or a quarter of the median if that is more - are outliers.
+    static constexpr uint16_t outlierMM = 100;
+
+    RangeFilter() {
+        reset();
+    }
+
+    void reset() {
+        std::fill(samples_, samples_ + window, UNDEF_RANGE);
+        next_ = 0;
+        value_ = FilteredRange{UNDEF_RANGE, 0, 0, 0};
+        lastTime_ = 0;
+    }
+
+    /// Takes the next range along with the time in ms it got captured - the rate is over these times.
+    const FilteredRange& update(uint16_t range, uint32_t timeMs) {
+        samples_[next_] = range;
+        next_ = (next_ + 1) % window;
+
+        // Insert the valid ranges in order - cheap for a window this small and bounded by it for the compiler too.
+        uint16_t sorted[window];
+        size_t valid = 0;
+        for (const auto sample : samples_) {
+            if (sample == UNDEF_RANGE) {
+                continue;
+            }
+            auto i = valid++;
+            while (i > 0 && sorted[i - 1] > sample) {
+                sorted[i] = sorted[i - 1];
+                --i;
+            }
+            sorted[i] = sample;
+        }
+        if (valid == 0) {
+            value_ = FilteredRange{UNDEF_RANGE, 0, 0, timeMs};
+            return value_;
+        }
+        const auto median = sorted[valid / 2];
+
+        const auto tolerance = std::max(int(outlierMM), median / 4);
+        size_t agreeing = 0;
+        for (size_t i = 0; i < valid; ++i) {
+            if (abs(int(sorted[i]) - int(median)) <= tolerance) {
+                ++agreeing;
+            }
+        }
+
+        // Smooth over about 4 updates as the median moves in steps.
+        auto rate = 0;
+        if (value_.range != UNDEF_RANGE && timeMs != lastTime_) {
+            const auto instant = (int32_t(median) - int32_t(value_.range)) * 1000 / int32_t(timeMs - lastTime_);
+            rate = value_.rate + (instant - value_.rate) / 4;
+        }
+        lastTime_ = timeMs;
+
+        value_.range = median;
+        value_.rate = int16_t(std::min(std::max(rate, -32767), 32767));
+        value_.confidence = uint8_t(agreeing * 100 / window);
+        value_.captureTime = timeMs;
+        return value_;
+    }
+
+    const FilteredRange& value() const {
+        return value_;
+    }
+
+private:
+    uint16_t samples_[window];
+    size_t next_;
+    FilteredRange value_;
+    uint32_t lastTime_;
+};
@@ -0,0 +1,180 @@
+// Copyright (c) 2022, Framework Labs.
+
+#include "pa_record.h"
+
+#include <cstring>
+
+static const uint8_t recordMagic[4] = {'E', 'G', 'O', 'R'};
+
+static void storeU16(uint8_t* data, uint16_t value) {
+    data[0] = uint8_t(value);
+    data[1] = uint8_t(value >> 8);
+}
+
+static void storeU32(uint8_t* data, uint32_t value) {
+    storeU16(data, uint16_t(value));
+    storeU16(data + 2, uint16_t(value >> 16));
+}
+
+uint16_t recordU16(const uint8_t* data) {
+    return uint16_t(data[0] | data[1] << 8);
+}
+
+uint32_t recordU32(const uint8_t* data) {
+    return recordU16(data) | uint32_t{recordU16(data + 2)} << 16;
+}
+
+// Recording
+
+bool InputRecorder::begin(RecordSink& sink, uint8_t node) {
+    uint8_t header[RECORD_HEADER_SIZE];
+    memcpy(header, recordMagic, sizeof(recordMagic));
+    header[4] = RECORD_VERSION;
+    header[5] = node;
+    if (!sink.write(header, sizeof(header))) {
+        return false;
+    }
+    sink_ = &sink;
+    return true;
+}
+
+bool InputRecorder::isRecording() const {
+    return sink_ != nullptr;
+}
+
+void InputRecorder::beginTick(uint32_t nowMs) {
+    if (sink_ == nullptr) {
+        return;
+    }
+    if (inTick_) {
+        endTick();
+    }
+    inTick_ = true;
+    size_ = 0;
+
+    const auto elapsed = ticked_ ? nowMs - lastTickMs_ : 0;
+    ticked_ = true;
+    lastTickMs_ = nowMs;
+    if (reserve(RecordType::TICK, 2)) {
+        uint8_t payload[2];
+        storeU16(payload, uint16_t(elapsed > 0xFFFF ? 0xFFFF : elapsed));
+        put(payload, sizeof(payload));
+    }
+}
+
+void InputRecorder::recordDatagram(uint32_t from, const uint8_t* data, size_t size) {
+    if (!inTick_ || !reserve(RecordType::DATAGRAM, 4 + size)) {
+        return;
+    }
+    uint8_t addr[4];
+    storeU32(addr, from);
+    put(addr, sizeof(addr));
+    put(data, size);
+}
+
+void InputRecorder::recordButtons(uint8_t mask) {
+    if (!inTick_ || !reserve(RecordType::BUTTONS, 1)) {
+        return;
+    }
+    put(&mask, 1);
+}
+
+void InputRecorder::recordValue(uint8_t tag, const void* data, size_t size) {
+    if (!inTick_ || !reserve(RecordType::VALUE, 1 + size)) {
+        return;
+    }
+    put(&tag, 1);
+    put(data, size);
+}
+
+void InputRecorder::endTick() {
+    if (!inTick_) {
+        return;
+    }
+    inTick_ = false;
+    if (!sink_->write(buffer_, size_)) {
+        ++dropped_;
+    }
+}
+
+uint32_t InputRecorder::dropped() const {
+    return dropped_;
+}
+
+bool InputRecorder::reserve(RecordType type, size_t size) {
+    if (size > 0xFFFF || size_ + 3 + size > bufferSize) {
+        ++dropped_;
+        return false;
+    }
+    buffer_[size_] = uint8_t(type);
+    storeU16(buffer_ + size_ + 1, uint16_t(size));
+    size_ += 3;
+    return true;
+}
+
+void InputRecorder::put(const void* data, size_t size) {
+    memcpy(buffer_ + size_, data, size);
+    size_ += size;
+}
+
+RecordingTransport::RecordingTransport(PlanktonTransport& transport, InputRecorder& recorder)
+    : transport_{transport}, recorder_{recorder} {}
+
+bool RecordingTransport::begin(uint16_t port) {
+    return transport_.begin(port);
+}
+
+bool RecordingTransport::isConnected() {
+    return transport_.isConnected();
+}
+
+bool RecordingTransport::send(uint32_t addr, const uint8_t* data, size_t size) {
+    return transport_.send(addr, data, size);
+}
+
+bool RecordingTransport::joinGroup(uint32_t group) {
+    return transport_.joinGroup(group);
+}
+
+bool RecordingTransport::receive(uint8_t* data, size_t capacity, size_t& size, uint32_t& from) {
+    if (!transport_.receive(data, capacity, size, from)) {
+        return false;
+    }
+    // Truncated datagrams are recorded as far as they got copied - Plankton drops them anyway.
+    recorder_.recordDatagram(from, data, size < capacity ? size : capacity);
+    return true;
+}
+
+// Replaying
+
+// The header of version 1 lacks the node.
+static size_t headerSize(uint8_t version) {
+    return version == 1 ? RECORD_HEADER_SIZE - 1 : RECORD_HEADER_SIZE;
+}
+
+RecordReader::RecordReader(const uint8_t* data, size_t size)
+    : data_{data}, size_{size}, pos_{size > 4 ? headerSize(data[4]) : RECORD_HEADER_SIZE} {}
+
+bool RecordReader::isValid() const {
+    return size_ >= 5 && memcmp(data_, recordMagic, sizeof(recordMagic)) == 0 &&
+           (data_[4] == 1 || data_[4] == RECORD_VERSION) && size_ >= headerSize(data_[4]);
+}
+
+uint8_t RecordReader::node() const {
+    return isValid() && data_[4] != 1 ? data_[5] : 0;
+}
+
+bool RecordReader::next(Record& record) {
+    if (!isValid() || size_ - pos_ < 3) {
+        return false;
+    }
+    const auto size = recordU16(data_ + pos_ + 1);
+    if (size_ - pos_ - 3 < size) {
+        return false;
+    }
+    record.type = RecordType(data_[pos_]);
+    record.payload = data_ + pos_ + 3;
+    record.size = size;
+    pos_ += 3 + size;
+    return true;
+}
@@ -0,0 +1,130 @@
+// pa_record
+//
+// Copyright (c) 2022, Framework Labs.
+
+#pragma once
+
+#include <plankton_transport.h>
+
+#include <cstddef>
+#include <cstdint>
+
+// Stream Format
+//
+// A stream starts with the magic "EGOR", a version byte and a byte telling which node recorded it -
+// version 1 streams lack the latter. Then come records, each made of a type byte, a little-endian
+// 16 bit payload size and the payload:
+//
+// - TICK: 16 bit milliseconds since the previous tick - all records up to the next TICK are
+//   the inputs of this tick.
+// - DATAGRAM: 32 bit sender address followed by the datagram as the transport received it.
+// - BUTTONS: 8 bit mask with bit n set while button n is pressed.
+// - VALUE: 8 bit tag followed by a raw value like a range reading.
+//
+// All integers are little-endian.
+
+enum class RecordType : uint8_t {
+    TICK = 1,
+    DATAGRAM,
+    BUTTONS,
+    VALUE,
+};
+
+constexpr uint8_t RECORD_VERSION = 2;
+constexpr size_t RECORD_HEADER_SIZE = 6;
+
+#ifndef PA_RECORD_BUFFER
+#define PA_RECORD_BUFFER 1024
+#endif
+
+// Recording
+
+/// Where a recorder writes its stream to.
+class RecordSink {
+public:
+    virtual ~RecordSink() = default;
+
+    virtual bool write(const uint8_t* data, size_t size) = 0;
+};
+
+/// Collects the inputs of each tick and writes them to the sink in one go at the end of the tick.
+///
+/// Records which do not fit into the tick buffer are dropped and counted.
+class InputRecorder {
+public:
+    static constexpr size_t bufferSize = PA_RECORD_BUFFER;
+
+    /// Writes the stream header with the node doing the recording - nothing gets recorded before.
+    bool begin(RecordSink& sink, uint8_t node = 0);
+
+    bool isRecording() const;
+
+    void beginTick(uint32_t nowMs);
+    void recordDatagram(uint32_t from, const uint8_t* data, size_t size);
+    void recordButtons(uint8_t mask);
+    void recordValue(uint8_t tag, const void* data, size_t size);
+    void endTick();
+
+    /// Number of records dropped as they did not fit into the buffer or the sink failed.
+    uint32_t dropped() const;
+
+private:
+    bool reserve(RecordType type, size_t size);
+    void put(const void* data, size_t size);
+
+    RecordSink* sink_ = nullptr;
+    bool inTick_ = false;
+    bool ticked_ = false;
+    uint32_t lastTickMs_ = 0;
+    uint32_t dropped_ = 0;
+    size_t size_ = 0;
+    uint8_t buffer_[bufferSize];
+};
+
+/// Passes all calls to another transport and records each datagram it receives.
+class RecordingTransport : public PlanktonTransport {
+public:
+    RecordingTransport(PlanktonTransport& transport, InputRecorder& recorder);
+
+    bool begin(uint16_t port) override;
+    bool isConnected() override;
+    bool send(uint32_t addr, const uint8_t* data, size_t size) override;
+    bool joinGroup(uint32_t group) override;
+    bool receive(uint8_t* data, size_t capacity, size_t& size, uint32_t& from) override;
+
+private:
+    PlanktonTransport& transport_;
+    InputRecorder& recorder_;
+};
+
+// Replaying
+
+/// Reads the records of a stream held in memory.
+class RecordReader {
+public:
+    struct Record {
+        RecordType type;
+        const uint8_t* payload;
+        uint16_t size;
+    };
+
+    RecordReader(const uint8_t* data, size_t size);
+
+    /// Whether the stream starts with a header this reader understands.
+    bool isValid() const;
+
+    /// The node which recorded the stream - 0 for version 1 streams.
+    uint8_t node() const;
+
+    /// Advances to the next record - returns false at the end or if the stream is cut off.
+    bool next(Record& record);
+
+private:
+    const uint8_t* data_;
+    size_t size_;
+    size_t pos_;
+};
+
+/// Little-endian helpers for reading payloads.
+uint16_t recordU16(const uint8_t* data);
+uint32_t recordU32(const uint8_t* data);
@@ -0,0 +1,74 @@
+// pa_record_sinks
+//
+// Copyright (c) 2022, Framework Labs.
+
+#pragma once
+
+#include "pa_record.h"
+
+#include <plankton.h>
+
+#include <Arduino.h>
+#include <FS.h>
+
+#include <algorithm>
+
+/// Writes the stream as lines of "@rec <hex>" so that it can share Serial with the log.
+class SerialRecordSink : public RecordSink {
+public:
+    bool write(const uint8_t* data, size_t size) override {
+        static const char digits[] = "0123456789abcdef";
+        char line[2 * 32];
+        while (size > 0) {
+            const auto count = std::min(size, sizeof(line) / 2);
+            for (size_t i = 0; i < count; ++i) {
+                line[2 * i] = digits[data[i] >> 4];
+                line[2 * i + 1] = digits[data[i] & 0xF];
+            }
+            Serial.print("@rec ");
+            Serial.write((const uint8_t*)line, 2 * count);
+            Serial.print('\n');
+            data += count;
+            size -= count;
+        }
+        return true;
+    }
+};
+
+/// Appends the stream to a file - e.g. on SPIFFS.
+class FileRecordSink : public RecordSink {
+public:
+    explicit FileRecordSink(fs::File file) : file_{file} {}
+
+    bool write(const uint8_t* data, size_t size) override {
+        return file_ && file_.write(data, size) == size;
+    }
+
+private:
+    fs::File file_;
+};
+
+/// Publishes the stream in stamped chunks on a topic, so that a capture can tell about gaps.
+/// Begin the recorder only once Plankton is connected as the header would get lost otherwise.
+class PlanktonRecordSink : public RecordSink {
+public:
+    PlanktonRecordSink(Plankton& plankton, uint32_t topic) : plankton_{plankton}, topic_{topic} {
+        plankton_.advertise(topic_, {true, true, 0, false});
+    }
+
+    bool write(const uint8_t* data, size_t size) override {
+        while (size > 0) {
+            const auto count = std::min(size, size_t{Plankton::maxPayload});
+            if (!plankton_.publish(topic_, data, count)) {
+                return false;
+            }
+            data += count;
+            size -= count;
+        }
+        return true;
+    }
+
+private:
+    Plankton& plankton_;
+    uint32_t topic_;
+};
@@ -0,0 +1,63 @@
+// motion_profile
+//
+// Copyright (c) 2022, Framework Labs.
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+
+/// Limits of a `MotionProfile` - per second and per second squared in the unit of the value.
+struct ProfileLimits {
+    float maxAcceleration;
+    float maxJerk;
+};
+
+/// Moves a value like a speed towards a target with limited acceleration and jerk.
+///
+/// The acceleration ramps up and down with the jerk limit instead of jumping, and it gets reduced early enough
+/// to reach 0 right at the target - so the value does not overshoot unless the target jumps back on it.
+/// Plain C++ without Arduino so that it runs on the host too.
+class MotionProfile {
+public:
+    MotionProfile() : value_{0}, acceleration_{0} {}
+
+    void reset(float value) {
+        value_ = value;
+        acceleration_ = 0;
+    }
+
+    /// Advances the profile by `dt` seconds - keep `dt` short against the time the jerk limit needs to ramp
+    /// the acceleration up, as the profile is only exact at the steps.
+    float update(float target, const ProfileLimits& limits, float dt) {
+        const auto error = target - value_;
+
+        // The acceleration which can still be ramped down to 0 by the time the target is reached - ramping it
+        // down in steps of `dt` changes the value by a * a / 2j + a * dt / 2.
+        const auto reachable = limits.maxJerk * (std::sqrt(dt * dt / 4 + 2 * std::fabs(error) / limits.maxJerk) - dt / 2);
+        const auto desired = std::copysign(std::min(limits.maxAcceleration, reachable), error);
+
+        const auto step = limits.maxJerk * dt;
+        acceleration_ += std::max(-step, std::min(step, desired - acceleration_));
+        value_ += acceleration_ * dt;
+
+        // Settle once the target is within the last step instead of dithering around it.
+        if (std::fabs(target - value_) <= std::fabs(acceleration_) * dt && std::fabs(acceleration_) <= step) {
+            value_ = target;
+            acceleration_ = 0;
+        }
+        return value_;
+    }
+
+    float value() const {
+        return value_;
+    }
+
+    float acceleration() const {
+        return acceleration_;
+    }
+
+private:
+    float value_;
+    float acceleration_;
+};
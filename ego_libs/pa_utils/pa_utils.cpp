@@ -4,13 +4,244 @@
 
 #include <utility/Button.h>
 
+#include <Arduino.h>
+
 // Timing
 
+static uint32_t sharedTickTime;
+
+uint32_t tickTime() {
+    return sharedTickTime;
+}
+
 pa_activity_def (Delay, unsigned n) {
-    pa_self.i = n;
-    while (pa_self.i > 0) {
+    pa_self.until = tickTime() + n * DELAY_STEP;
+    while (int32_t(pa_self.until - tickTime()) > 0) {
         pa_pause;
-        pa_self.i -= 1;
+    }
+} pa_end;
+
+// Motion Profiles
+
+pa_activity_def (JerkLimiter, const ProfileLimits& limits, int8_t target, bool halt, int8_t& value) {
+    pa_self.profile.reset(value);
+    pa_self.lastTime = tickTime();
+    pa_always {
+        if (halt) {
+            pa_self.profile.reset(0);
+        } else {
+            const auto elapsed = tickTime() - pa_self.lastTime;
+            const auto steps = (elapsed + PROFILE_STEP - 1) / PROFILE_STEP;
+            for (uint32_t i = 0; i < steps; ++i) {
+                pa_self.profile.update(target, limits, elapsed / 1000.0f / steps);
+            }
+        }
+        pa_self.lastTime = tickTime();
+        value = int8_t(lroundf(pa_self.profile.value()));
+    } pa_always_end;
+} pa_end;
+
+// Scheduling
+
+RateScheduler::RateScheduler(uint32_t basePeriod) : basePeriod_{basePeriod}, baseTicks_{0}, numTrees_{0} {}
+
+uint32_t RateScheduler::basePeriod() const {
+    return basePeriod_;
+}
+
+bool RateScheduler::add(Tick tick, unsigned divider, unsigned phase) {
+    if (numTrees_ == maxTrees || tick == nullptr || divider == 0 || phase >= divider) {
+        return false;
+    }
+    trees_[numTrees_++] = Tree{tick, divider, phase};
+    return true;
+}
+
+void RateScheduler::tick() {
+    for (size_t i = 0; i < numTrees_; ++i) {
+        const auto& tree = trees_[i];
+        if (baseTicks_ % tree.divider == tree.phase) {
+            tree.tick();
+        }
+    }
+    ++baseTicks_;
+    sharedTickTime += basePeriod_;
+}
+
+void RateScheduler::tickAfter(uint32_t elapsed) {
+    // The time base got advanced by a full period after the previous tick already.
+    if (baseTicks_ != 0 && elapsed < basePeriod_) {
+        sharedTickTime -= basePeriod_ - elapsed;
+    }
+    tick();
+}
+
+// CPU Frequency
+
+CpuGovernor::CpuGovernor(uint32_t periodMs, uint8_t upLoad, uint8_t downLoad, uint32_t holdMs)
+    : periodMicros_{periodMs * 1000}, upLoad_{upLoad * 10u}, downLoad_{downLoad * 10u}, holdMs_{holdMs},
+      level_{CpuLevel::MHZ_80}, floor_{CpuLevel::MHZ_80}, load_{0}, started_{false}, lastMs_{0}, low_{false},
+      lowSinceMs_{0}, timeInLevel_{} {}
+
+uint32_t CpuGovernor::frequencyMhz(CpuLevel level) {
+    return 80 * (uint32_t(level) + 1);
+}
+
+void CpuGovernor::setFloor(CpuLevel level) {
+    floor_ = level;
+}
+
+CpuLevel CpuGovernor::floor() const {
+    return floor_;
+}
+
+bool CpuGovernor::update(uint32_t nowMs, uint32_t tickMicros) {
+    if (started_) {
+        timeInLevel_[size_t(level_)] += nowMs - lastMs_;
+    }
+    started_ = true;
+    lastMs_ = nowMs;
+
+    // Smooth over about 8 ticks - a single long tick should not boost the CPU on its own.
+    const auto sample = uint32_t(min(uint64_t{tickMicros} * 1000 / periodMicros_, uint64_t{2000}));
+    load_ = load_ - load_ / 8 + sample / 8;
+
+    auto level = level_;
+    if (load_ > upLoad_ && level != CpuLevel::MHZ_240) {
+        level = CpuLevel(uint8_t(level) + 1);
+        low_ = false;
+    } else if (level != CpuLevel::MHZ_80) {
+        const auto lower = CpuLevel(uint8_t(level) - 1);
+        const auto predicted = load_ * frequencyMhz(level) / frequencyMhz(lower);
+        if (predicted >= downLoad_) {
+            low_ = false;
+        } else if (!low_) {
+            low_ = true;
+            lowSinceMs_ = nowMs;
+        } else if (nowMs - lowSinceMs_ >= holdMs_) {
+            level = lower;
+            low_ = false;
+        }
+    }
+    if (uint8_t(level) < uint8_t(floor_)) {
+        level = floor_;
+        low_ = false;
+    }
+    if (level == level_) {
+        return false;
+    }
+
+    // The same work takes longer at a lower frequency and vice versa.
+    load_ = load_ * frequencyMhz(level_) / frequencyMhz(level);
+    level_ = level;
+    return true;
+}
+
+CpuLevel CpuGovernor::level() const {
+    return level_;
+}
+
+uint32_t CpuGovernor::frequencyMhz() const {
+    return frequencyMhz(level_);
+}
+
+uint32_t CpuGovernor::load() const {
+    return load_;
+}
+
+uint32_t CpuGovernor::timeInLevel(CpuLevel level) const {
+    return timeInLevel_[size_t(level)];
+}
+
+void CpuGovernor::print() const {
+    Serial.printf("cpu: %u MHz load: %u%% time at 80/160/240 MHz: %u/%u/%u s\n",
+                  frequencyMhz(), load_ / 10, timeInLevel_[0] / 1000, timeInLevel_[1] / 1000, timeInLevel_[2] / 1000);
+}
+
+// Tick Monitoring
+
+TickMonitor::TickMonitor(uint32_t periodMs, bool enabled)
+    : periodMicros_{periodMs * 1000}, enabled_{enabled}, governor_{nullptr} {
+    resetStats();
+}
+
+void TickMonitor::setEnabled(bool enabled) {
+    enabled_ = enabled;
+}
+
+bool TickMonitor::isEnabled() const {
+    return enabled_;
+}
+
+void TickMonitor::setGovernor(CpuGovernor* governor) {
+    governor_ = governor;
+}
+
+void TickMonitor::beginTick() {
+    if (enabled_) {
+        start_ = micros();
+    }
+}
+
+void TickMonitor::endTick() {
+    if (!enabled_) {
+        return;
+    }
+    const uint32_t elapsed = micros() - start_;
+
+    stats_.ticks += 1;
+    if (elapsed > periodMicros_) {
+        stats_.missed += 1;
+    }
+    stats_.minMicros = min(stats_.minMicros, elapsed);
+    stats_.maxMicros = max(stats_.maxMicros, elapsed);
+    totalMicros_ += elapsed;
+
+    const auto quarters = uint64_t{elapsed} * 4 / periodMicros_;
+    auto& bucket = stats_.histogram[quarters < 4 ? quarters : (quarters < 8 ? 4 : 5)];
+    if (bucket != UINT16_MAX) {
+        bucket += 1;
+    }
+
+    if (governor_ != nullptr && governor_->update(millis(), elapsed)) {
+        setCpuFrequencyMhz(governor_->frequencyMhz());
+    }
+}
+
+TickStats TickMonitor::stats() const {
+    auto stats = stats_;
+    stats.avgMicros = stats.ticks != 0 ? uint32_t(totalMicros_ / stats.ticks) : 0;
+    if (stats.ticks == 0) {
+        stats.minMicros = 0;
+    }
+    return stats;
+}
+
+void TickMonitor::resetStats() {
+    stats_ = TickStats{};
+    stats_.minMicros = UINT32_MAX;
+    totalMicros_ = 0;
+}
+
+void TickMonitor::print() const {
+    const auto stats = this->stats();
+    Serial.printf("ticks: %u missed: %u min/avg/max: %u/%u/%u us histogram: %u %u %u %u | %u %u\n",
+                  stats.ticks, stats.missed, stats.minMicros, stats.avgMicros, stats.maxMicros,
+                  stats.histogram[0], stats.histogram[1], stats.histogram[2], stats.histogram[3],
+                  stats.histogram[4], stats.histogram[5]);
+    if (governor_ != nullptr) {
+        governor_->print();
+    }
+}
+
+pa_activity_def (TickLogger, const TickMonitor& monitor, unsigned period) {
+    while (true) {
+        pa_self.ticks = period;
+        while (pa_self.ticks > 0) {
+            pa_pause;
+            pa_self.ticks -= 1;
+        }
+        monitor.print();
     }
 } pa_end;
 
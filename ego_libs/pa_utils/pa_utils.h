@@ -6,12 +6,181 @@
 
 #include "pa_utils_priv.h"
 
+#include <cstddef>
+#include <cstdint>
 #include <string>
 
 // Timing
 
+/// Milliseconds which one step of `Delay` lasts - the period of the original 10 Hz tick loops.
+constexpr uint32_t DELAY_STEP = 100;
+
+/// Milliseconds of the time base shared by all activity trees of a node - advanced by `RateScheduler`.
+uint32_t tickTime();
+
+/// Waits for `n` steps of `DELAY_STEP` on the shared time base - independent of the rate of the calling tree.
 pa_activity_sig (Delay, unsigned n);
 
+// Scheduling
+
+/// Ticks several activity trees at integer fractions of a common base rate.
+///
+/// Each tree is ticked on every `divider`th base tick - e.g. on a 20 ms base, control could run with divider 1
+/// at 50 Hz while lights and display use divider 5 for 10 Hz. The `phase` spreads trees of the same rate over
+/// different base ticks. Trees which are due in the same base tick run in the order they were added.
+class RateScheduler {
+public:
+    static constexpr size_t maxTrees = 4;
+
+    using Tick = void (*)();
+
+    explicit RateScheduler(uint32_t basePeriod);
+
+    /// Milliseconds between two base ticks.
+    uint32_t basePeriod() const;
+
+    /// Adds a tree - returns false if there is no room left or the divider or phase is invalid.
+    bool add(Tick tick, unsigned divider, unsigned phase = 0);
+
+    /// Runs one base tick and advances the shared time base by `basePeriod` afterwards.
+    void tick();
+
+    /// Like `tick` but for a base tick which runs `elapsed` ms after the previous one - earlier than `basePeriod`
+    /// when the loop got woken by input. The shared time base then only moves by the time which actually passed,
+    /// so that `Delay` and the motion profiles keep to real time. Such an input tick counts as a base tick though,
+    /// so it ticks the slower trees a little early too.
+    void tickAfter(uint32_t elapsed);
+
+private:
+    struct Tree {
+        Tick tick;
+        unsigned divider;
+        unsigned phase;
+    };
+
+    uint32_t basePeriod_;
+    uint32_t baseTicks_;
+    Tree trees_[maxTrees];
+    size_t numTrees_;
+};
+
+// CPU Frequency
+
+/// The CPU frequencies a `CpuGovernor` steps between.
+enum class CpuLevel : uint8_t {
+    MHZ_80,
+    MHZ_160,
+    MHZ_240
+};
+
+/// Steps the CPU frequency by the load of the ticks of a loop.
+///
+/// The load is the smoothed share of the period a tick takes. Above `upLoad` percent the governor steps up
+/// right away. It only steps down once the load predicted for the next lower frequency stayed below `downLoad`
+/// percent for `holdMs` - keep `downLoad` well below `upLoad` to not step back and forth.
+/// A floor keeps the frequency up ahead of load known to come, like driving autonomously.
+///
+/// The governor only decides - `update` takes the time from the caller so that it runs on a fake clock too.
+class CpuGovernor {
+public:
+    static constexpr size_t numLevels = 3;
+
+    explicit CpuGovernor(uint32_t periodMs, uint8_t upLoad = 70, uint8_t downLoad = 40, uint32_t holdMs = 2000);
+
+    static uint32_t frequencyMhz(CpuLevel level);
+
+    /// Keeps the level at or above `level` from the next update on.
+    void setFloor(CpuLevel level);
+    CpuLevel floor() const;
+
+    /// Feeds the duration of the last tick - returns true if the level changed.
+    bool update(uint32_t nowMs, uint32_t tickMicros);
+
+    CpuLevel level() const;
+    uint32_t frequencyMhz() const;
+
+    /// Smoothed load in per mille of the period.
+    uint32_t load() const;
+
+    /// Milliseconds spent at the level up to the last update.
+    uint32_t timeInLevel(CpuLevel level) const;
+
+    /// Prints the level and the time spent in each level on a single line to Serial.
+    void print() const;
+
+private:
+    uint32_t periodMicros_;
+    uint32_t upLoad_;
+    uint32_t downLoad_;
+    uint32_t holdMs_;
+    CpuLevel level_;
+    CpuLevel floor_;
+    uint32_t load_;
+    bool started_;
+    uint32_t lastMs_;
+    bool low_;
+    uint32_t lowSinceMs_;
+    uint32_t timeInLevel_[numLevels];
+};
+
+// Motion Profiles
+
+/// Milliseconds of each step a `JerkLimiter` takes - several per tick at the usual tick rates.
+constexpr uint32_t PROFILE_STEP = 5;
+
+/// Follows `target` with `value` along a `MotionProfile` - starting from the value it has got when started.
+/// The profile advances in steps of `PROFILE_STEP` over the time the shared time base moved since the last tick.
+/// With `halt` set, the value drops to 0 right away - for stopping in front of an obstacle.
+pa_activity_sig (JerkLimiter, const ProfileLimits& limits, int8_t target, bool halt, int8_t& value);
+
+// Tick Monitoring
+
+/// Execution times of the ticks of a loop - laid out to fit a Plankton payload.
+struct TickStats {
+    uint32_t ticks;         ///< Ticks measured.
+    uint32_t missed;        ///< Ticks which took longer than the period - the loop has to catch up on them.
+    uint32_t minMicros;     ///< Shortest tick.
+    uint32_t avgMicros;     ///< Average tick.
+    uint32_t maxMicros;     ///< Longest tick.
+    uint16_t histogram[6];  ///< Ticks by quarters of the period, then up to two and beyond two periods - saturating.
+};
+
+/// Measures the work done in each tick of a loop against its period.
+///
+/// Call `beginTick` right after the loop woke up and `endTick` before it goes to sleep again.
+/// When disabled, both only check a flag.
+///
+/// With a governor set, `endTick` feeds it and applies the CPU frequency it decides on.
+class TickMonitor {
+public:
+    explicit TickMonitor(uint32_t periodMs, bool enabled = true);
+
+    void setEnabled(bool enabled);
+    bool isEnabled() const;
+
+    void setGovernor(CpuGovernor* governor);
+
+    void beginTick();
+    void endTick();
+
+    TickStats stats() const;
+    void resetStats();
+
+    /// Prints the stats on a single line to Serial - followed by the governor if there is one.
+    void print() const;
+
+private:
+    uint32_t periodMicros_;
+    bool enabled_;
+    CpuGovernor* governor_;
+    uint32_t start_;
+    uint64_t totalMicros_;
+    TickStats stats_;
+};
+
+/// Prints the stats of the monitor every `period` ticks.
+pa_activity_sig (TickLogger, const TickMonitor& monitor, unsigned period);
+
 // Button
 
 class Button;
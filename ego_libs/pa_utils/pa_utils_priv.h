@@ -2,11 +2,21 @@
 
 #pragma once
 
+#include "motion_profile.h"
+
 #include <proto_activities.h>
 
 // Timing
 
-pa_activity_ctx (Delay, unsigned i);
+pa_activity_ctx (Delay, uint32_t until);
+
+// Motion Profiles
+
+pa_activity_ctx (JerkLimiter, MotionProfile profile; uint32_t lastTime);
+
+// Tick Monitoring
+
+pa_activity_ctx (TickLogger, unsigned ticks);
 
 // Button
 
@@ -4,94 +4,598 @@
 
 #pragma once
 
-#include <WiFi.h>
-#include <WiFiUdp.h>
+#include "plankton_clock.h"
+#include "plankton_config.h"
+#include "plankton_transport.h"
 
-#include <map>
-#include <vector>
+#include <algorithm>
+#include <cstring>
 
-/// A simple pub-sub mechanism which broadcasts UDP packets from publishers to subscribers.
+/// A simple pub-sub mechanism which sends UDP packets from publishers to subscribers.
+///
+/// Subscriptions live in a fixed-capacity table with a preallocated payload slot per topic,
+/// so `poll()` and `read()` never touch the heap.
+/// The packets are sent and received via a `PlanktonTransport` - a `SocketTransport` runs on the
+/// lwIP sockets of the ESP32 as well as on a POSIX host, where a `LoopbackTransport` also connects
+/// several Plankton instances within a process.
+///
+/// Topics are broadcast unless advertised as multicast, in which case they only go to the nodes
+/// which joined the `planktonGroup` of the topic or the `planktonChannelGroup` of the configured
+/// channel - every subscription joins the group its config selects.
+///
+/// A packet starts with the 4 byte topic. If the topic was advertised as stamped, the topic has the
+/// `stampedFlag` bit set and is followed by a 2 byte sequence number and the 4 byte sender time in ms.
+/// The payload comes last.
+///
+/// Reliable topics additionally set the `reliableFlag` bit. Their subscribers answer each packet
+/// with an ack consisting of the topic with the `ackFlag` bit set and the sequence number.
+/// Until the first ack arrives, the publisher resends the latest packet from `poll()` with
+/// exponential backoff - a newer publish replaces the packet in flight.
+/// Subscribers drop the duplicates this may cause.
+///
+/// With batching enabled, packets to the same destination are collected until `flush()` and sent
+/// as a single datagram. It starts with the `batchMarker` word followed by the packets - each one
+/// prefixed by its size as a byte.
 class Plankton {
 public:
+    static constexpr size_t maxTopics = PLANKTON_MAX_TOPICS;
+    static constexpr size_t maxPayload = PLANKTON_MAX_PAYLOAD;
+
+    explicit Plankton(PlanktonTransport& transport) : transport_{transport} {}
+
     void begin() {
-        udp_.begin(planktonPort);
+        begun_ = transport_.begin(planktonPort);
+        if (begun_) {
+            for (size_t i = 0; i < numEntries_; ++i) {
+                transport_.joinGroup(groupOf(entries_[i].topic, entries_[i].config.channel));
+            }
+        }
+    }
+
+    // Publishing
+
+    struct PublicationConfig {
+        bool stamped;    ///< Prefix packets with a sequence number and timestamp.
+        bool multicast;  ///< Send to the group of the topic or channel instead of broadcasting.
+        uint8_t channel; ///< The channel to multicast to - 0 selects the group of the topic.
+        bool reliable;   ///< Resend until acknowledged - meant for low rate event topics, implies stamped.
+    };
+
+    /// Optionally declares how a topic is published - unadvertised topics are sent unstamped.
+    bool advertise(uint32_t topic, PublicationConfig config) {
+        if (numPublications_ == maxTopics || findPublication(topic) != nullptr) {
+            return false;
+        }
+        auto& pub = publications_[numPublications_];
+        pub.topic = topic;
+        pub.config = config;
+        pub.seq = 0;
+        pub.stats = TopicStats{};
+        pub.pending = false;
+        ++numPublications_;
+        return true;
     }
 
+    /// Publishes right away or - if batching - queues the packet until the next `flush()`.
     bool publish(uint32_t topic, const uint8_t* data, size_t size) {
-        if (!WiFi.isConnected()) {
+        if (!transport_.isConnected() || size > maxPayload) {
             return false;
         }
-        if (udp_.beginPacket(IPAddress(0xFFFFFFFF), planktonPort) != 1) {
+
+        const auto pub = findPublication(topic);
+        const auto len = encode(pub, topic, data, size, txBuf_);
+        const auto addr = pub != nullptr && pub->config.multicast ? groupOf(topic, pub->config.channel) : PlanktonTransport::broadcastAddr;
+        if (pub != nullptr) {
+            ++pub->stats.txPackets;
+            pub->stats.txBytes += size;
+            if (pub->config.reliable) {
+                keepPending(*pub, addr, len);
+            }
+        }
+        if (!batching_) {
+            return send(addr, txBuf_, len);
+        }
+
+        if (batchLen_ != 0 && (addr != batchAddr_ || batchLen_ + 1 + len > sizeof(batchBuf_))) {
+            flush();
+        }
+        if (batchLen_ == 0) {
+            const auto marker = batchMarker;
+            memcpy(batchBuf_, &marker, sizeof(marker));
+            batchLen_ = sizeof(batchMarker);
+            batchAddr_ = addr;
+            batchCount_ = 0;
+        }
+        batchBuf_[batchLen_] = len;
+        memcpy(batchBuf_ + batchLen_ + 1, txBuf_, len);
+        batchLen_ += 1 + len;
+        ++batchCount_;
+        return true;
+    }
+
+    /// Enables or disables batching - the latter flushes any pending batch.
+    void setBatching(bool batching) {
+        if (!batching) {
+            flush();
+        }
+        batching_ = batching;
+    }
+
+    /// Sends the packets queued while batching - call this once per tick.
+    bool flush() {
+        if (batchLen_ == 0) {
+            return true;
+        }
+        const auto len = batchLen_;
+        batchLen_ = 0;
+        if (!transport_.isConnected()) {
             return false;
         }
-        udp_.write((const uint8_t*)&topic, sizeof(topic));
-        udp_.write(data, size);
-        return udp_.endPacket() == 1;
+        if (batchCount_ == 1) {
+            // A lone packet goes out without the batch framing.
+            return send(batchAddr_, batchBuf_ + sizeof(batchMarker) + 1, len - sizeof(batchMarker) - 1);
+        }
+        return send(batchAddr_, batchBuf_, len);
     }
 
-    struct SubscriptionConfig {};
+    // Subscribing
+
+    struct SubscriptionConfig {
+        uint8_t channel; ///< The channel the topic is multicast to - 0 selects the group of the topic.
+    };
 
     bool subscribe(uint32_t topic, SubscriptionConfig config) {
-        if (entries_.count(topic) == 1) {
+        if (numEntries_ == maxTopics || findEntry(topic) != nullptr) {
             return false;
         }
-        auto entry = TopicEntry{};
+        auto& entry = entries_[numEntries_];
+        entry = TopicEntry{};
+        entry.topic = topic;
         entry.config = config;
-        entries_[topic] = entry;
+        ++numEntries_;
+        if (begun_) {
+            transport_.joinGroup(groupOf(topic, config.channel));
+        }
         return true;
     }
 
+    /// Limits the work done by a single `poll` - a zero means no limit.
+    struct PollBudget {
+        uint16_t maxDatagrams; ///< Stop after receiving this many datagrams.
+        uint32_t maxMicros;    ///< Stop once this many microseconds have passed.
+    };
+
+    /// Receives all pending packets and resends unacknowledged reliable ones.
     bool poll() {
-        if (!WiFi.isConnected()) {
+        auto morePending = false;
+        return poll(PollBudget{}, morePending);
+    }
+
+    /// Like `poll()` but stops early once the budget is used up - which is signaled by `morePending`.
+    /// This keeps a flood of packets from eating up the whole tick.
+    bool poll(PollBudget budget, bool& morePending) {
+        morePending = false;
+        if (!transport_.isConnected()) {
             return false;
         }
 
+        // The packets of a poll count as received at its start - which saves reading the clock for each one.
+        const auto start = planktonMicros();
+        const auto now = planktonMillis();
         auto hasNewPacket = false;
+        auto count = size_t{};
+        auto from = uint32_t{};
+        auto numDatagrams = uint16_t{};
         while (true) {
-            const auto count = udp_.parsePacket();
-            if (count <= 4) {
-                return hasNewPacket;
+            if ((budget.maxDatagrams != 0 && numDatagrams == budget.maxDatagrams) ||
+                (budget.maxMicros != 0 && planktonMicros() - start >= budget.maxMicros)) {
+                morePending = true;
+                break;
             }
+            if (!transport_.receive(rxBuf_, sizeof(rxBuf_), count, from)) {
+                break;
+            }
+            ++numDatagrams;
 
-            const auto topic = uint32_t{};
-            udp_.read((uint8_t*)&topic, sizeof(topic));
+            ++stats_.rxDatagrams;
+            stats_.rxBytes += count;
+            count = std::min(count, sizeof(rxBuf_));
+            if (count <= plainHeaderSize) {
+                ++stats_.rxRunts;
+                continue;
+            }
 
-            const auto it = entries_.find(topic);
-            if (it == entries_.end()) {
-                udp_.flush();
+            auto word = uint32_t{};
+            memcpy(&word, rxBuf_, sizeof(word));
+            if (word != batchMarker) {
+                hasNewPacket |= handlePacket(rxBuf_, count, from, now);
                 continue;
             }
 
-            auto& entry = it->second;
-            entry.data.resize(count - 4);
-            udp_.read((unsigned char*)entry.data.data(), entry.data.size());
-            
-            hasNewPacket = true;
+            for (auto offset = sizeof(batchMarker); offset < count; ) {
+                const auto len = size_t{rxBuf_[offset]};
+                if (offset + 1 + len > count) {
+                    ++stats_.rxRunts;
+                    break;
+                }
+                hasNewPacket |= handlePacket(rxBuf_ + offset + 1, len, from, now);
+                offset += 1 + len;
+            }
         }
+
+        resendPending();
+
+        return hasNewPacket;
     }
 
     bool read(uint32_t topic, uint8_t* data, size_t size) {
-        if (!WiFi.isConnected()) {
+        if (!transport_.isConnected()) {
             return false;
         }
-        const auto it = entries_.find(topic);
-        if (it == entries_.end()) {
+        const auto entry = findEntry(topic);
+        if (entry == nullptr) {
             return false;
         }
 
-        const auto& buf = it->second.data;
-        memcpy(data, buf.data(), min(buf.size(), size));
+        memcpy(data, entry->data, std::min(size_t(entry->size), size));
+        return true;
+    }
+
+    /// Describes the sample returned by `read`.
+    struct SampleInfo {
+        uint32_t age;         ///< Milliseconds since the sample was received.
+        uint32_t count;       ///< Number of samples received so far - changes with every new sample.
+        bool stamped;         ///< Whether the fields below are valid.
+        uint16_t seq;         ///< The sequence number of the sample.
+        uint32_t senderTime;  ///< The time the sample was sent on the clock of the sender.
+        uint32_t lost;        ///< Total number of packets missing in the sequence so far.
+        uint32_t reordered;   ///< Total number of packets which arrived late and were discarded.
+        uint32_t duplicates;  ///< Total number of packets which arrived more than once and were discarded.
+    };
+
+    /// Like `read` but also describes the sample - returns false if nothing was received yet.
+    bool read(uint32_t topic, uint8_t* data, size_t size, SampleInfo& info) {
+        return read(topic, data, size) && describe(topic, info);
+    }
+
+    /// Describes the last sample of a topic - returns false if nothing was received yet.
+    bool describe(uint32_t topic, SampleInfo& info) const {
+        const auto entry = findEntry(topic);
+        if (entry == nullptr || entry->count == 0) {
+            return false;
+        }
+        info.age = planktonMillis() - entry->receivedAt;
+        info.count = entry->count;
+        info.stamped = entry->stamped;
+        info.seq = entry->seq;
+        info.senderTime = entry->senderTime;
+        info.lost = entry->stats.lost;
+        info.reordered = entry->stats.reordered;
+        info.duplicates = entry->stats.duplicates;
         return true;
     }
 
+    /// Gives access to the payload slot of the last sample without copying it.
+    /// Returns nullptr if nothing was received yet. The slot is overwritten by the next `poll()`.
+    const uint8_t* peek(uint32_t topic, size_t& size) const {
+        const auto entry = findEntry(topic);
+        if (!transport_.isConnected() || entry == nullptr || entry->count == 0) {
+            return nullptr;
+        }
+        size = entry->size;
+        return entry->data;
+    }
+
+    // Statistics
+
+    /// Counters over all topics.
+    struct Stats {
+        uint32_t rxDatagrams; ///< Datagrams received - a batch counts once.
+        uint32_t rxBytes;     ///< Bytes of those datagrams.
+        uint32_t rxUnknown;   ///< Packets dropped as their topic is not subscribed.
+        uint32_t rxRunts;     ///< Packets dropped as they were too short or malformed.
+        uint32_t txDatagrams; ///< Datagrams handed to the transport.
+        uint32_t txBytes;     ///< Bytes of those datagrams.
+        uint32_t txFailed;    ///< Datagrams the transport failed to send.
+    };
+
+    /// Counters of a single topic.
+    struct TopicStats {
+        uint32_t rxPackets;   ///< Packets received on the topic - including discarded ones.
+        uint32_t rxBytes;     ///< Payload bytes of those packets.
+        uint32_t lost;        ///< Packets missing in the sequence.
+        uint32_t reordered;   ///< Packets discarded as they arrived late.
+        uint32_t duplicates;  ///< Packets discarded as they arrived more than once.
+        uint32_t jitter;      ///< Smoothed variation in ms of the transit time - or of the inter-arrival time if unstamped.
+        uint32_t txPackets;   ///< Packets published on the topic.
+        uint32_t txBytes;     ///< Payload bytes of those packets.
+        uint32_t resends;     ///< Reliable packets resent for lack of an ack.
+    };
+
+    /// A snapshot of the global counters.
+    Stats stats() const {
+        return stats_;
+    }
+
+    /// A snapshot of the counters of a subscribed or advertised topic - returns false for other topics.
+    bool topicStats(uint32_t topic, TopicStats& stats) const {
+        const auto entry = findEntry(topic);
+        const auto pub = const_cast<Plankton*>(this)->findPublication(topic);
+        if (entry == nullptr && pub == nullptr) {
+            return false;
+        }
+        stats = entry != nullptr ? entry->stats : TopicStats{};
+        if (pub != nullptr) {
+            stats.txPackets = pub->stats.txPackets;
+            stats.txBytes = pub->stats.txBytes;
+            stats.resends = pub->stats.resends;
+        }
+        return true;
+    }
+
+    void resetStats() {
+        stats_ = Stats{};
+        for (size_t i = 0; i < numEntries_; ++i) {
+            entries_[i].stats = TopicStats{};
+        }
+        for (size_t i = 0; i < numPublications_; ++i) {
+            publications_[i].stats = TopicStats{};
+        }
+    }
+
 private:
+    static constexpr uint32_t stampedFlag = 0x80000000;
+    static constexpr uint32_t reliableFlag = 0x40000000;
+    static constexpr uint32_t ackFlag = 0x20000000;
+    static constexpr uint32_t topicMask = 0x1FFFFFFF;
+    static constexpr uint32_t batchMarker = 0x7FFFFFFF;
+    static constexpr size_t plainHeaderSize = 4;
+    static constexpr size_t stampedHeaderSize = 10;
+    static constexpr size_t ackSize = 6;
+
+    /// The first resend happens this long after the publish - each further one takes twice as long.
+    static constexpr uint32_t resendTimeout = PLANKTON_RESEND_TIMEOUT;
+    static constexpr uint8_t maxResends = PLANKTON_MAX_RESENDS;
+
+    /// A jump back further than this is taken as a restart of the sender.
+    static constexpr int16_t reorderWindow = 32;
+
+    struct Publication {
+        uint32_t topic;
+        PublicationConfig config;
+        uint16_t seq;
+        TopicStats stats;
+
+        // The reliable packet in flight.
+        bool pending;
+        uint8_t resends;
+        uint32_t resendAt;
+        uint32_t addr;
+        uint8_t len;
+        uint8_t packet[maxPayload + stampedHeaderSize];
+    };
+
     struct TopicEntry {
+        uint32_t topic;
         SubscriptionConfig config;
-        std::vector<uint8_t> data;
+        uint32_t count;
+        bool stamped;
+        uint16_t seq;
+        uint32_t senderTime;
+        uint32_t receivedAt;
+        TopicStats stats;
+        int32_t prevTransit;
+        uint32_t jitter16; // The jitter scaled by 16 to keep precision.
+        uint8_t size;
+        uint8_t data[maxPayload];
     };
 
+    static_assert(maxPayload + stampedHeaderSize <= 255, "packet size must fit into a byte");
+    static_assert(maxPayload + stampedHeaderSize + 5 <= PLANKTON_MAX_DATAGRAM, "datagram must hold the largest packet");
+
+    static uint32_t groupOf(uint32_t topic, uint8_t channel) {
+        return channel == 0 ? planktonGroup(topic) : planktonChannelGroup(channel);
+    }
+
+    static size_t encode(Publication* pub, uint32_t topic, const uint8_t* data, size_t size, uint8_t* buf) {
+        auto len = size_t{};
+        if (pub != nullptr && (pub->config.stamped || pub->config.reliable)) {
+            const auto word = topic | stampedFlag | (pub->config.reliable ? reliableFlag : 0);
+            const auto time = planktonMillis();
+            memcpy(buf, &word, sizeof(word));
+            memcpy(buf + 4, &pub->seq, sizeof(pub->seq));
+            memcpy(buf + 6, &time, sizeof(time));
+            len = stampedHeaderSize;
+            ++pub->seq;
+        } else {
+            memcpy(buf, &topic, sizeof(topic));
+            len = plainHeaderSize;
+        }
+        memcpy(buf + len, data, size);
+        return len + size;
+    }
+
+    void keepPending(Publication& pub, uint32_t addr, size_t len) {
+        pub.pending = true;
+        pub.resends = 0;
+        pub.resendAt = planktonMillis() + resendTimeout;
+        pub.addr = addr;
+        pub.len = len;
+        memcpy(pub.packet, txBuf_, len);
+    }
+
+    void resendPending() {
+        const auto now = planktonMillis();
+        for (size_t i = 0; i < numPublications_; ++i) {
+            auto& pub = publications_[i];
+            if (!pub.pending || int32_t(now - pub.resendAt) < 0) {
+                continue;
+            }
+            if (pub.resends == maxResends) {
+                pub.pending = false;
+                continue;
+            }
+            send(pub.addr, pub.packet, pub.len);
+            ++pub.stats.resends;
+            ++pub.resends;
+            pub.resendAt = now + (resendTimeout << pub.resends);
+        }
+    }
+
+    void handleAck(uint32_t topic, const uint8_t* packet, size_t count) {
+        const auto pub = findPublication(topic);
+        if (count != ackSize || pub == nullptr || !pub->pending) {
+            return;
+        }
+        auto seq = uint16_t{};
+        auto pendingSeq = uint16_t{};
+        memcpy(&seq, packet + 4, sizeof(seq));
+        memcpy(&pendingSeq, pub->packet + 4, sizeof(pendingSeq));
+        if (seq == pendingSeq) {
+            pub->pending = false;
+        }
+    }
+
+    void sendAck(uint32_t topic, const uint8_t* seq, uint32_t addr) {
+        uint8_t ack[ackSize];
+        const auto word = topic | ackFlag;
+        memcpy(ack, &word, sizeof(word));
+        memcpy(ack + 4, seq, 2);
+        send(addr, ack, sizeof(ack));
+    }
+
+    bool send(uint32_t addr, const uint8_t* data, size_t size) {
+        ++stats_.txDatagrams;
+        stats_.txBytes += size;
+        if (!transport_.send(addr, data, size)) {
+            ++stats_.txFailed;
+            return false;
+        }
+        return true;
+    }
+
+    /// Estimates the jitter like RTP does (RFC 3550) - with the sender time if stamped.
+    static void updateJitter(TopicEntry& entry, uint32_t now, bool stamped, uint32_t senderTime) {
+        // Without a sender time, the transit is the inter-arrival time which needs two samples.
+        const auto transit = int32_t(now - (stamped ? senderTime : entry.receivedAt));
+        if (entry.count >= (stamped ? 1u : 2u) && entry.stamped == stamped) {
+            const auto d = transit - entry.prevTransit;
+            entry.jitter16 += (d < 0 ? -d : d) - int32_t((entry.jitter16 + 8) >> 4);
+            entry.stats.jitter = entry.jitter16 >> 4;
+        }
+        entry.prevTransit = transit;
+    }
+
+    bool handlePacket(const uint8_t* packet, size_t count, uint32_t from, uint32_t now) {
+        if (count <= plainHeaderSize) {
+            ++stats_.rxRunts;
+            return false;
+        }
+
+        auto word = uint32_t{};
+        memcpy(&word, packet, sizeof(word));
+        const auto topic = word & topicMask;
+        if ((word & ackFlag) != 0) {
+            handleAck(topic, packet, count);
+            return false;
+        }
+
+        // Reject foreign traffic before looking any further.
+        const auto entry = findEntry(topic);
+        if (entry == nullptr) {
+            ++stats_.rxUnknown;
+            return false;
+        }
+
+        const auto stamped = (word & stampedFlag) != 0;
+        const auto headerSize = stamped ? stampedHeaderSize : plainHeaderSize;
+        if (count <= headerSize) {
+            ++stats_.rxRunts;
+            return false;
+        }
+        ++entry->stats.rxPackets;
+        entry->stats.rxBytes += count - headerSize;
+
+        auto senderTime = uint32_t{};
+        if (stamped) {
+            if ((word & reliableFlag) != 0) {
+                sendAck(topic, packet + 4, from);
+            }
+
+            auto seq = uint16_t{};
+            memcpy(&seq, packet + 4, sizeof(seq));
+            if (!acceptSeq(*entry, seq)) {
+                return false;
+            }
+            memcpy(&senderTime, packet + 6, sizeof(senderTime));
+        }
+        updateJitter(*entry, now, stamped, senderTime);
+        entry->senderTime = senderTime;
+        entry->stamped = stamped;
+        ++entry->count;
+        entry->receivedAt = now;
+
+        // Oversized payloads are truncated to the slot - the remainder is dropped.
+        entry->size = std::min(count - headerSize, size_t{maxPayload});
+        memcpy(entry->data, packet + headerSize, entry->size);
+        return true;
+    }
+
+    static bool acceptSeq(TopicEntry& entry, uint16_t seq) {
+        if (entry.count != 0 && entry.stamped) {
+            const auto delta = int16_t(seq - entry.seq);
+            if (delta == 0) {
+                ++entry.stats.duplicates;
+                return false;
+            }
+            if (delta < 0 && delta > -reorderWindow) {
+                ++entry.stats.reordered;
+                return false;
+            }
+            if (delta > 1) {
+                entry.stats.lost += delta - 1;
+            }
+        }
+        entry.seq = seq;
+        return true;
+    }
+
+    // A linear scan beats sorting or hashing for the handful of topics a node uses.
+    const TopicEntry* findEntry(uint32_t topic) const {
+        for (size_t i = 0; i < numEntries_; ++i) {
+            if (entries_[i].topic == topic) {
+                return &entries_[i];
+            }
+        }
+        return nullptr;
+    }
+
+    TopicEntry* findEntry(uint32_t topic) {
+        return const_cast<TopicEntry*>(static_cast<const Plankton*>(this)->findEntry(topic));
+    }
+
+    Publication* findPublication(uint32_t topic) {
+        for (size_t i = 0; i < numPublications_; ++i) {
+            if (publications_[i].topic == topic) {
+                return &publications_[i];
+            }
+        }
+        return nullptr;
+    }
+
 private:
-    static constexpr uint16_t planktonPort = 4839;
-    WiFiUDP udp_;
-    std::map<uint32_t, TopicEntry> entries_;
+    PlanktonTransport& transport_;
+    bool begun_ = false;
+    TopicEntry entries_[maxTopics];
+    size_t numEntries_ = 0;
+    Publication publications_[maxTopics];
+    size_t numPublications_ = 0;
+    uint8_t txBuf_[maxPayload + stampedHeaderSize];
+    uint8_t rxBuf_[PLANKTON_MAX_DATAGRAM];
+    bool batching_ = false;
+    uint8_t batchBuf_[PLANKTON_MAX_DATAGRAM];
+    size_t batchLen_ = 0;
+    size_t batchCount_ = 0;
+    uint32_t batchAddr_ = 0;
+    Stats stats_ = {};
 };
@@ -0,0 +1,42 @@
+// plankton_clock
+//
+// Copyright (c) 2022, Framework Labs.
+
+#pragma once
+
+#include <cstdint>
+
+#ifdef ARDUINO
+
+#include <Arduino.h>
+
+/// Milliseconds since boot - wraps around after ~49 days.
+inline uint32_t planktonMillis() {
+    return millis();
+}
+
+/// Microseconds since boot - wraps around after ~71 minutes.
+inline uint32_t planktonMicros() {
+    return micros();
+}
+
+#else
+
+#include <chrono>
+
+inline std::chrono::steady_clock::duration planktonUptime() {
+    static const auto start = std::chrono::steady_clock::now();
+    return std::chrono::steady_clock::now() - start;
+}
+
+/// Milliseconds since the first call - wraps around after ~49 days.
+inline uint32_t planktonMillis() {
+    return uint32_t(std::chrono::duration_cast<std::chrono::milliseconds>(planktonUptime()).count());
+}
+
+/// Microseconds since the first call - wraps around after ~71 minutes.
+inline uint32_t planktonMicros() {
+    return uint32_t(std::chrono::duration_cast<std::chrono::microseconds>(planktonUptime()).count());
+}
+
+#endif
@@ -0,0 +1,44 @@
+// plankton_config
+//
+// Copyright (c) 2022, Framework Labs.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Capacities - override via build flags if needed.
+
+#ifndef PLANKTON_MAX_TOPICS
+#define PLANKTON_MAX_TOPICS 8
+#endif
+
+#ifndef PLANKTON_MAX_PAYLOAD
+#define PLANKTON_MAX_PAYLOAD 32
+#endif
+
+/// Room for a batch of several packets each consisting of topic, header and payload.
+#ifndef PLANKTON_MAX_DATAGRAM
+#define PLANKTON_MAX_DATAGRAM 256
+#endif
+
+/// Reliable packets are resent after this many ms, doubling with each of the max resends.
+#ifndef PLANKTON_RESEND_TIMEOUT
+#define PLANKTON_RESEND_TIMEOUT 30
+#endif
+
+#ifndef PLANKTON_MAX_RESENDS
+#define PLANKTON_MAX_RESENDS 5
+#endif
+
+constexpr uint16_t planktonPort = 4839;
+
+/// Topics are multicast to their own group 239.255.x.y with x.y being the lower 16 bits of the topic.
+constexpr uint32_t planktonGroup(uint32_t topic) {
+    return 0xEFFF0000 | (topic & 0xFFFF);
+}
+
+/// Alternatively, topics can share the group 239.255.255.c of a channel c in 1...255.
+constexpr uint32_t planktonChannelGroup(uint8_t channel) {
+    return 0xEFFFFF00 | channel;
+}
@@ -0,0 +1,166 @@
+// plankton_loopback
+//
+// Copyright (c) 2022, Framework Labs.
+
+#pragma once
+
+#include "plankton_transport.h"
+
+#include <algorithm>
+#include <cstring>
+
+#ifndef PLANKTON_LOOPBACK_NODES
+#define PLANKTON_LOOPBACK_NODES 4
+#endif
+
+#ifndef PLANKTON_LOOPBACK_DEPTH
+#define PLANKTON_LOOPBACK_DEPTH 16
+#endif
+
+class LoopbackTransport;
+
+/// Connects the loopback transports of several Plankton instances within one process.
+class LoopbackBus {
+public:
+    static constexpr size_t maxNodes = PLANKTON_LOOPBACK_NODES;
+
+private:
+    friend class LoopbackTransport;
+
+    /// Attaches the transport and returns its address - or 0 if the bus is full.
+    uint32_t attach(LoopbackTransport& transport) {
+        if (numNodes_ == maxNodes) {
+            return 0;
+        }
+        nodes_[numNodes_++] = &transport;
+        return firstAddr + numNodes_ - 1;
+    }
+
+    void deliver(uint32_t from, uint32_t to, const uint8_t* data, size_t size);
+
+    static constexpr uint32_t firstAddr = 0x7F000001; // 127.0.0.1
+
+private:
+    LoopbackTransport* nodes_[maxNodes];
+    size_t numNodes_ = 0;
+};
+
+/// Delivers datagrams to the transports on the same bus.
+///
+/// Broadcasts go to all transports, multicasts only to those which joined the group.
+/// Each transport gets its own address in 127.0.0.x for unicasts.
+/// As on a real network, the sender gets a copy too if it is a receiver.
+/// Each node buffers up to `depth` datagrams; further ones are dropped just like a full socket buffer would.
+class LoopbackTransport : public PlanktonTransport {
+public:
+    static constexpr size_t depth = PLANKTON_LOOPBACK_DEPTH;
+
+    explicit LoopbackTransport(LoopbackBus& bus) : bus_{bus} {}
+
+    bool begin(uint16_t /*port*/) override {
+        if (addr_ == 0) {
+            addr_ = bus_.attach(*this);
+        }
+        return addr_ != 0;
+    }
+
+    bool isConnected() override {
+        return addr_ != 0;
+    }
+
+    /// The unicast address of this transport - 0 until `begin()` succeeded.
+    uint32_t addr() const {
+        return addr_;
+    }
+
+    bool send(uint32_t addr, const uint8_t* data, size_t size) override {
+        if (addr_ == 0 || size > PLANKTON_MAX_DATAGRAM) {
+            return false;
+        }
+        bus_.deliver(addr_, addr, data, size);
+        return true;
+    }
+
+    bool joinGroup(uint32_t group) override {
+        if (isMember(group)) {
+            return true;
+        }
+        if (numGroups_ == maxGroups) {
+            return false;
+        }
+        groups_[numGroups_++] = group;
+        return true;
+    }
+
+    bool receive(uint8_t* data, size_t capacity, size_t& size, uint32_t& from) override {
+        if (count_ == 0) {
+            return false;
+        }
+        const auto& slot = slots_[head_];
+        size = slot.size;
+        from = slot.from;
+        memcpy(data, slot.data, std::min(size, capacity));
+        head_ = (head_ + 1) % depth;
+        --count_;
+        return true;
+    }
+
+    /// The number of datagrams dropped because the receive queue was full.
+    size_t dropped() const {
+        return dropped_;
+    }
+
+private:
+    friend class LoopbackBus;
+
+    static constexpr size_t maxGroups = PLANKTON_MAX_TOPICS;
+
+    bool accepts(uint32_t addr) const {
+        return addr == broadcastAddr || addr == addr_ || isMember(addr);
+    }
+
+    bool isMember(uint32_t group) const {
+        for (size_t i = 0; i < numGroups_; ++i) {
+            if (groups_[i] == group) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void deliver(uint32_t from, const uint8_t* data, size_t size) {
+        if (count_ == depth) {
+            ++dropped_;
+            return;
+        }
+        auto& slot = slots_[(head_ + count_) % depth];
+        slot.size = size;
+        slot.from = from;
+        memcpy(slot.data, data, size);
+        ++count_;
+    }
+
+private:
+    struct Slot {
+        size_t size;
+        uint32_t from;
+        uint8_t data[PLANKTON_MAX_DATAGRAM];
+    };
+
+    LoopbackBus& bus_;
+    uint32_t addr_ = 0;
+    uint32_t groups_[maxGroups];
+    size_t numGroups_ = 0;
+    Slot slots_[depth];
+    size_t head_ = 0;
+    size_t count_ = 0;
+    size_t dropped_ = 0;
+};
+
+inline void LoopbackBus::deliver(uint32_t from, uint32_t to, const uint8_t* data, size_t size) {
+    for (size_t i = 0; i < numNodes_; ++i) {
+        if (nodes_[i]->accepts(to)) {
+            nodes_[i]->deliver(from, data, size);
+        }
+    }
+}
@@ -0,0 +1,66 @@
+// plankton_ring
+//
+// Copyright (c) 2022, Framework Labs.
+
+#pragma once
+
+#include "plankton_config.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+
+/// Lock-free queue of datagrams between exactly one producer and one consumer thread.
+///
+/// The producer only writes `tail_` and the consumer only writes `head_` - each publishes its slot
+/// with release semantics after it is done with it. Neither side ever waits for the other: a full
+/// ring rejects the datagram just like a full socket buffer would drop it.
+template <size_t depth>
+class PlanktonRing {
+    static_assert(depth > 0 && (depth & (depth - 1)) == 0, "ring depth must be a power of two");
+
+public:
+    /// Producer side - returns false if the ring is full.
+    bool push(uint32_t addr, const uint8_t* data, size_t size) {
+        const auto tail = tail_.load(std::memory_order_relaxed);
+        if (tail - head_.load(std::memory_order_acquire) == depth) {
+            return false;
+        }
+        auto& slot = slots_[tail % depth];
+        slot.addr = addr;
+        slot.size = uint16_t(std::min(size, size_t{0xFFFF}));
+        memcpy(slot.data, data, std::min(size, sizeof(slot.data)));
+        tail_.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    /// Consumer side - copies at most `capacity` bytes and reports the full size like `PlanktonTransport::receive`.
+    bool pop(uint8_t* data, size_t capacity, size_t& size, uint32_t& addr) {
+        const auto head = head_.load(std::memory_order_relaxed);
+        if (head == tail_.load(std::memory_order_acquire)) {
+            return false;
+        }
+        const auto& slot = slots_[head % depth];
+        addr = slot.addr;
+        size = slot.size;
+        memcpy(data, slot.data, std::min({size, capacity, sizeof(slot.data)}));
+        head_.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    /// Only a hint as the other side may change it right away.
+    bool empty() const {
+        return head_.load(std::memory_order_acquire) == tail_.load(std::memory_order_acquire);
+    }
+
+private:
+    struct Slot {
+        uint32_t addr;
+        uint16_t size;
+        uint8_t data[PLANKTON_MAX_DATAGRAM];
+    };
+
+    Slot slots_[depth];
+    std::atomic<uint32_t> head_{0};
+    std::atomic<uint32_t> tail_{0};
+};
@@ -0,0 +1,130 @@
+// plankton_socket
+//
+// Copyright (c) 2022, Framework Labs.
+
+#pragma once
+
+#include "plankton_transport.h"
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#ifdef ARDUINO_ARCH_ESP32
+#include <WiFi.h>
+#endif
+
+/// Sends and receives over a plain BSD UDP socket.
+///
+/// This runs Plankton on a POSIX host but also on the ESP32 on top of lwIP. Unlike the WiFiUDP class
+/// of the Arduino core, it can block until a datagram arrives which allows for event-driven receiving.
+///
+/// Broadcasts go to the limited broadcast address by default; pass `INADDR_LOOPBACK` to stay on the host.
+/// In the latter case multicast groups are joined on the loopback interface too.
+/// On the ESP32, the transport is only connected while WiFi is - the socket itself outlives the connection.
+class SocketTransport : public PlanktonTransport {
+public:
+    explicit SocketTransport(uint32_t broadcastAddr = INADDR_BROADCAST) : broadcastAddr_{broadcastAddr} {}
+
+    ~SocketTransport() override {
+        if (fd_ >= 0) {
+            close(fd_);
+        }
+    }
+
+    SocketTransport(const SocketTransport&) = delete;
+    SocketTransport& operator=(const SocketTransport&) = delete;
+
+    bool begin(uint16_t port) override {
+        fd_ = socket(AF_INET, SOCK_DGRAM, 0);
+        if (fd_ < 0) {
+            return false;
+        }
+
+        // Several nodes may share one host, so let all of them bind the Plankton port.
+        const int on = 1;
+        setsockopt(fd_, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+#ifdef SO_REUSEPORT
+        setsockopt(fd_, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on));
+#endif
+        setsockopt(fd_, SOL_SOCKET, SO_BROADCAST, &on, sizeof(on));
+        fcntl(fd_, F_SETFL, fcntl(fd_, F_GETFL, 0) | O_NONBLOCK);
+        if (broadcastAddr_ == INADDR_LOOPBACK) {
+            in_addr loopback{};
+            loopback.s_addr = htonl(INADDR_LOOPBACK);
+            setsockopt(fd_, IPPROTO_IP, IP_MULTICAST_IF, &loopback, sizeof(loopback));
+        }
+
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_ANY);
+        addr.sin_port = htons(port);
+        if (bind(fd_, (const sockaddr*)&addr, sizeof(addr)) != 0) {
+            close(fd_);
+            fd_ = -1;
+            return false;
+        }
+        port_ = port;
+        return true;
+    }
+
+    bool isConnected() override {
+#ifdef ARDUINO_ARCH_ESP32
+        if (!WiFi.isConnected()) {
+            return false;
+        }
+#endif
+        return fd_ >= 0;
+    }
+
+    bool send(uint32_t addr, const uint8_t* data, size_t size) override {
+        sockaddr_in dest{};
+        dest.sin_family = AF_INET;
+        dest.sin_addr.s_addr = htonl(addr == broadcastAddr ? broadcastAddr_ : addr);
+        dest.sin_port = htons(port_);
+        return sendto(fd_, data, size, 0, (const sockaddr*)&dest, sizeof(dest)) == (ssize_t)size;
+    }
+
+    bool joinGroup(uint32_t group) override {
+        ip_mreq mreq{};
+        mreq.imr_multiaddr.s_addr = htonl(group);
+        mreq.imr_interface.s_addr = htonl(broadcastAddr_ == INADDR_LOOPBACK ? INADDR_LOOPBACK : INADDR_ANY);
+        return setsockopt(fd_, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) == 0;
+    }
+
+    /// Blocks until a datagram is pending or `timeoutMs` passed - returns whether one is pending.
+    bool wait(uint32_t timeoutMs) {
+        fd_set fds;
+        FD_ZERO(&fds);
+        FD_SET(fd_, &fds);
+        timeval timeout{};
+        timeout.tv_sec = timeoutMs / 1000;
+        timeout.tv_usec = (timeoutMs % 1000) * 1000;
+        return select(fd_ + 1, &fds, nullptr, nullptr, &timeout) > 0;
+    }
+
+    bool receive(uint8_t* data, size_t capacity, size_t& size, uint32_t& from) override {
+#ifdef MSG_TRUNC
+        const auto flags = MSG_TRUNC; // Report the full size even if the datagram gets truncated.
+#else
+        const auto flags = 0;
+#endif
+        sockaddr_in src{};
+        socklen_t srcLen = sizeof(src);
+        const auto count = recvfrom(fd_, data, capacity, flags, (sockaddr*)&src, &srcLen);
+        if (count < 0) {
+            return false;
+        }
+        size = count;
+        from = ntohl(src.sin_addr.s_addr);
+        return true;
+    }
+
+private:
+    uint32_t broadcastAddr_;
+    uint16_t port_ = 0;
+    int fd_ = -1;
+};
@@ -0,0 +1,117 @@
+// plankton_task
+//
+// Copyright (c) 2022, Framework Labs.
+
+#pragma once
+
+#include "plankton_ring.h"
+#include "plankton_socket.h"
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#include <atomic>
+
+#ifndef PLANKTON_TASK_DEPTH
+#define PLANKTON_TASK_DEPTH 16
+#endif
+
+#ifndef PLANKTON_TASK_STACK
+#define PLANKTON_TASK_STACK 4096
+#endif
+
+/// Does the socket I/O of Plankton in a FreeRTOS task of its own - usually pinned to the core
+/// the tick loop does not run on.
+///
+/// `send` and `receive` only touch two lock-free rings which the network task fills and drains,
+/// so neither a busy network nor a blocking lwIP call delays the tick. Plankton itself keeps
+/// running in the tick loop and sees the datagrams on its next `poll()` - a task waiting for them can
+/// ask to be notified when they got queued. Multicast groups are joined right away as lwIP serializes
+/// socket options with the receiving task.
+class TaskTransport : public PlanktonTransport {
+public:
+    static constexpr size_t depth = PLANKTON_TASK_DEPTH;
+
+    explicit TaskTransport(SocketTransport& socket, BaseType_t core = 0, UBaseType_t priority = 2)
+        : socket_{socket}, core_{core}, priority_{priority} {}
+
+    TaskTransport(const TaskTransport&) = delete;
+    TaskTransport& operator=(const TaskTransport&) = delete;
+
+    bool begin(uint16_t port) override {
+        if (task_ != nullptr) {
+            return true;
+        }
+        if (!socket_.begin(port)) {
+            return false;
+        }
+        return xTaskCreatePinnedToCore(run, "plankton", PLANKTON_TASK_STACK, this, priority_, &task_, core_) == pdPASS;
+    }
+
+    bool isConnected() override {
+        return task_ != nullptr && socket_.isConnected();
+    }
+
+    /// Queues the datagram for the network task - fails if it fell behind by `depth` datagrams.
+    bool send(uint32_t addr, const uint8_t* data, size_t size) override {
+        return isConnected() && tx_.push(addr, data, size);
+    }
+
+    bool joinGroup(uint32_t group) override {
+        return task_ != nullptr && socket_.joinGroup(group);
+    }
+
+    bool receive(uint8_t* data, size_t capacity, size_t& size, uint32_t& from) override {
+        return rx_.pop(data, capacity, size, from);
+    }
+
+    /// Gives `task` a FreeRTOS notification whenever received datagrams got queued - nullptr stops it.
+    void notifyOnReceive(TaskHandle_t task) {
+        notifyTask_.store(task, std::memory_order_relaxed);
+    }
+
+    /// Number of received datagrams dropped as the tick loop did not pick them up in time.
+    uint32_t dropped() const {
+        return dropped_.load(std::memory_order_relaxed);
+    }
+
+private:
+    static void run(void* self) {
+        static_cast<TaskTransport*>(self)->loop();
+    }
+
+    void loop() {
+        auto size = size_t{};
+        auto addr = uint32_t{};
+        while (true) {
+            while (tx_.pop(buf_, sizeof(buf_), size, addr)) {
+                socket_.send(addr, buf_, size);
+            }
+            // Waiting for at most a millisecond bounds the latency of queued sends.
+            if (socket_.wait(1)) {
+                auto queued = false;
+                while (socket_.receive(buf_, sizeof(buf_), size, addr)) {
+                    if (rx_.push(addr, buf_, size)) {
+                        queued = true;
+                    } else {
+                        dropped_.fetch_add(1, std::memory_order_relaxed);
+                    }
+                }
+                const auto task = notifyTask_.load(std::memory_order_relaxed);
+                if (queued && task != nullptr) {
+                    xTaskNotifyGive(task);
+                }
+            }
+        }
+    }
+
+    SocketTransport& socket_;
+    BaseType_t core_;
+    UBaseType_t priority_;
+    TaskHandle_t task_ = nullptr;
+    std::atomic<TaskHandle_t> notifyTask_{nullptr};
+    PlanktonRing<depth> rx_;
+    PlanktonRing<depth> tx_;
+    std::atomic<uint32_t> dropped_{0};
+    uint8_t buf_[PLANKTON_MAX_DATAGRAM];
+};
@@ -0,0 +1,31 @@
+// plankton_transport
+//
+// Copyright (c) 2022, Framework Labs.
+
+#pragma once
+
+#include "plankton_config.h"
+
+/// The datagram service Plankton sends and receives its packets through.
+class PlanktonTransport {
+public:
+    static constexpr uint32_t broadcastAddr = 0xFFFFFFFF;
+
+    virtual ~PlanktonTransport() = default;
+
+    virtual bool begin(uint16_t port) = 0;
+
+    virtual bool isConnected() = 0;
+
+    /// Sends a single datagram to the given IPv4 address (in host byte order).
+    /// This is either `broadcastAddr`, a multicast group or the address of a single node.
+    virtual bool send(uint32_t addr, const uint8_t* data, size_t size) = 0;
+
+    /// Makes multicasts to the given group (in host byte order) arrive at this node.
+    virtual bool joinGroup(uint32_t group) = 0;
+
+    /// Receives the next pending datagram without blocking.
+    /// Copies at most `capacity` bytes to `data`, sets `size` to the full size of the datagram and
+    /// `from` to the address of the sender (in host byte order).
+    virtual bool receive(uint8_t* data, size_t capacity, size_t& size, uint32_t& from) = 0;
+};
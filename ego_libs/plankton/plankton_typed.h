@@ -0,0 +1,55 @@
+// plankton_typed
+//
+// Copyright (c) 2022, Framework Labs.
+
+#pragma once
+
+#include "plankton.h"
+
+#include <cstring>
+#include <type_traits>
+
+/// Binds a topic to the type of its payload.
+///
+/// The payload is sent as the in-memory representation of `T`, so `T` has to be trivially copyable
+/// and - where the compiler can tell - free of padding. Samples whose size does not match `T` are
+/// ignored by `read`.
+template <uint32_t topicId, typename T>
+struct TypedTopic {
+    static_assert(std::is_trivially_copyable<T>::value, "topic types must be trivially copyable");
+#if __cplusplus >= 201703L
+    static_assert(std::has_unique_object_representations<T>::value, "topic types must not contain padding");
+#endif
+    static_assert(sizeof(T) <= Plankton::maxPayload, "topic type exceeds the payload slot");
+
+    using Type = T;
+    static constexpr uint32_t topic = topicId;
+
+    static bool advertise(Plankton& plankton, Plankton::PublicationConfig config) {
+        return plankton.advertise(topic, config);
+    }
+
+    static bool publish(Plankton& plankton, const T& value) {
+        return plankton.publish(topic, (const uint8_t*)&value, sizeof(T));
+    }
+
+    static bool subscribe(Plankton& plankton, Plankton::SubscriptionConfig config) {
+        return plankton.subscribe(topic, config);
+    }
+
+    /// Copies the last sample from its slot right into `value` - returns false and leaves `value`
+    /// untouched if nothing of the right size was received yet.
+    static bool read(const Plankton& plankton, T& value) {
+        auto size = size_t{};
+        const auto data = plankton.peek(topic, size);
+        if (data == nullptr || size != sizeof(T)) {
+            return false;
+        }
+        memcpy(&value, data, sizeof(T));
+        return true;
+    }
+
+    static bool read(const Plankton& plankton, T& value, Plankton::SampleInfo& info) {
+        return read(plankton, value) && plankton.describe(topic, info);
+    }
+};
@@ -0,0 +1,461 @@
+// Plankton benchmarks
+//
+// Copyright (c) 2022, Framework Labs.
+//
+// Measures Plankton on the host against the real clock - unlike the simulation, which runs on a virtual one.
+//
+// Usage: program [-n packets]
+//
+// The results are printed to stdout:
+//
+//   lookup   - packets stored per second into the fixed topic table and into the std::map and std::vector one
+//              it replaced - the same packets from memory, with nothing but the lookup and the copy around them.
+//   table    - packets received per second over the loopback transport and the heap allocations done by
+//              poll() and read(), for Plankton and a bare loop over the std::map table. Plankton also keeps
+//              the stats and checks the framing of each packet, which the bare loop skips - so this compares
+//              the allocations rather than the speed of the tables.
+//   delivery - messages per second and the p50 and p99 latency from publishing to reading them, when
+//              flooding the RANGE and JOYSTICK topics over the loopback transport and over UDP sockets
+//              multicasting on the loopback interface of the host.
+
+#include <plankton.h>
+#include <plankton_loopback.h>
+#include <plankton_socket.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <new>
+#include <vector>
+
+// Heap Allocations
+
+static bool countingAllocations = false;
+static unsigned long allocations = 0;
+
+// Replacing the global operator new catches the allocations of all containers. Not inlining it and its
+// deletes keeps GCC from pairing their calls of malloc and free with the operators and warning about a mismatch.
+__attribute__((noinline)) void* operator new(size_t size) {
+    if (countingAllocations) {
+        ++allocations;
+    }
+    if (auto ptr = malloc(size != 0 ? size : 1)) {
+        return ptr;
+    }
+    throw std::bad_alloc{};
+}
+
+__attribute__((noinline)) void operator delete(void* ptr) noexcept {
+    free(ptr);
+}
+
+__attribute__((noinline)) void operator delete(void* ptr, size_t /*size*/) noexcept {
+    free(ptr);
+}
+
+/// Counts the heap allocations done while it is in scope.
+class AllocationCounter {
+public:
+    AllocationCounter() {
+        countingAllocations = true;
+    }
+
+    ~AllocationCounter() {
+        countingAllocations = false;
+    }
+};
+
+// Topics
+
+/// The topics of ego_common the motion node subscribes to - with the sizes of their payloads.
+struct BenchTopic {
+    uint32_t topic;
+    uint8_t size;
+};
+
+static constexpr BenchTopic benchTopics[] = {
+    {52, 28},   // RANGE
+    {53, 2},    // JOYSTICK
+    {54, 1},    // INTENT
+    {55, 1},    // PRESS
+};
+
+static constexpr size_t numBenchTopics = sizeof(benchTopics) / sizeof(benchTopics[0]);
+
+using Clock = std::chrono::steady_clock;
+
+static double seconds(Clock::duration duration) {
+    return std::chrono::duration<double>(duration).count();
+}
+
+// Topic Lookup
+
+/// The topic table of Plankton - a linear scan over entries with an inline payload slot each.
+class FixedTable {
+public:
+    bool subscribe(uint32_t topic) {
+        if (numEntries_ == Plankton::maxTopics) {
+            return false;
+        }
+        entries_[numEntries_++] = TopicEntry{topic, 0, {}};
+        return true;
+    }
+
+    void store(uint32_t topic, const uint8_t* data, size_t size) {
+        for (size_t i = 0; i < numEntries_; ++i) {
+            auto& entry = entries_[i];
+            if (entry.topic == topic) {
+                entry.size = uint8_t(std::min(size, Plankton::maxPayload));
+                memcpy(entry.data, data, entry.size);
+                return;
+            }
+        }
+    }
+
+    bool load(uint32_t topic, uint8_t* data, size_t size) const {
+        for (size_t i = 0; i < numEntries_; ++i) {
+            const auto& entry = entries_[i];
+            if (entry.topic == topic) {
+                memcpy(data, entry.data, std::min(size_t(entry.size), size));
+                return true;
+            }
+        }
+        return false;
+    }
+
+private:
+    struct TopicEntry {
+        uint32_t topic;
+        uint8_t size;
+        uint8_t data[Plankton::maxPayload];
+    };
+
+    TopicEntry entries_[Plankton::maxTopics];
+    size_t numEntries_ = 0;
+};
+
+/// The topic table Plankton had before - a std::map with a std::vector per topic, resized on every packet.
+class MapTable {
+public:
+    bool subscribe(uint32_t topic) {
+        return entries_.emplace(topic, std::vector<uint8_t>{}).second;
+    }
+
+    void store(uint32_t topic, const uint8_t* data, size_t size) {
+        const auto it = entries_.find(topic);
+        if (it != entries_.end()) {
+            it->second.resize(size);
+            memcpy(it->second.data(), data, size);
+        }
+    }
+
+    bool load(uint32_t topic, uint8_t* data, size_t size) const {
+        const auto it = entries_.find(topic);
+        if (it == entries_.end()) {
+            return false;
+        }
+        memcpy(data, it->second.data(), std::min(it->second.size(), size));
+        return true;
+    }
+
+private:
+    std::map<uint32_t, std::vector<uint8_t>> entries_;
+};
+
+/// Stores rounds of a packet per topic and reads all topics after each round - as poll() and read() would.
+template <typename Table>
+static double runLookup(unsigned long packets) {
+    Table table;
+    for (const auto& topic : benchTopics) {
+        table.subscribe(topic.topic);
+    }
+
+    uint8_t payload[Plankton::maxPayload] = {};
+    uint8_t data[Plankton::maxPayload];
+    auto checksum = 0u;
+    const auto start = Clock::now();
+    for (auto stored = 0ul; stored < packets; stored += numBenchTopics) {
+        for (const auto& topic : benchTopics) {
+            ++payload[0];
+            table.store(topic.topic, payload, topic.size);
+        }
+        for (const auto& topic : benchTopics) {
+            table.load(topic.topic, data, sizeof(data));
+            checksum += data[0];
+        }
+    }
+    const auto elapsed = Clock::now() - start;
+
+    // Using the data keeps the compiler from dropping the loads.
+    if (checksum == 1) {
+        printf("\n");
+    }
+    return packets / seconds(elapsed);
+}
+
+static void benchLookup(unsigned long packets) {
+    // The map allocates the vectors on the first round only, so run each once to warm up.
+    runLookup<FixedTable>(numBenchTopics);
+    runLookup<MapTable>(numBenchTopics);
+
+    printf("lookup: %lu packets of %zu topics\n", packets, numBenchTopics);
+    printf("  %-10s %12.0f packets/s\n", "fixed", runLookup<FixedTable>(packets));
+    printf("  %-10s %12.0f packets/s\n", "map", runLookup<MapTable>(packets));
+}
+
+// Topic Table
+
+/// The topic table Plankton had before - a std::map with a std::vector per topic, resized on every packet.
+class LegacyPlankton {
+public:
+    explicit LegacyPlankton(PlanktonTransport& transport) : transport_{transport} {}
+
+    void begin() {
+        transport_.begin(planktonPort);
+    }
+
+    bool subscribe(uint32_t topic, Plankton::SubscriptionConfig /*config*/) {
+        if (entries_.count(topic) == 1) {
+            return false;
+        }
+        entries_[topic] = TopicEntry{};
+        return true;
+    }
+
+    bool poll() {
+        auto hasNewPacket = false;
+        auto count = size_t{};
+        auto from = uint32_t{};
+        while (transport_.receive(buf_, sizeof(buf_), count, from)) {
+            if (count <= 4) {
+                continue;
+            }
+            auto topic = uint32_t{};
+            memcpy(&topic, buf_, sizeof(topic));
+
+            const auto it = entries_.find(topic);
+            if (it == entries_.end()) {
+                continue;
+            }
+            auto& entry = it->second;
+            entry.data.resize(count - 4);
+            memcpy(entry.data.data(), buf_ + 4, entry.data.size());
+            hasNewPacket = true;
+        }
+        return hasNewPacket;
+    }
+
+    bool read(uint32_t topic, uint8_t* data, size_t size) {
+        const auto it = entries_.find(topic);
+        if (it == entries_.end()) {
+            return false;
+        }
+        const auto& buf = it->second.data;
+        memcpy(data, buf.data(), std::min(buf.size(), size));
+        return true;
+    }
+
+private:
+    struct TopicEntry {
+        std::vector<uint8_t> data;
+    };
+
+    PlanktonTransport& transport_;
+    std::map<uint32_t, TopicEntry> entries_;
+    uint8_t buf_[PLANKTON_MAX_DATAGRAM];
+};
+
+struct TableResult {
+    double packetsPerSecond;
+    unsigned long allocations;
+};
+
+/// Publishes bursts of a packet per topic and times how long the subscriber takes to poll and read them.
+template <typename Subscriber>
+static TableResult runTable(unsigned long packets) {
+    LoopbackBus bus;
+    LoopbackTransport publisherTransport{bus};
+    LoopbackTransport subscriberTransport{bus};
+    Plankton publisher{publisherTransport};
+    Subscriber plankton{subscriberTransport};
+    publisher.begin();
+    plankton.begin();
+    for (const auto& topic : benchTopics) {
+        plankton.subscribe(topic.topic, {0});
+    }
+
+    // Bursts of two rounds stay within the depth of the loopback queue.
+    constexpr auto rounds = 2;
+    static_assert(rounds * numBenchTopics <= LoopbackTransport::depth, "bursts must fit into the loopback queue");
+
+    uint8_t payload[Plankton::maxPayload] = {};
+    uint8_t data[Plankton::maxPayload];
+    auto received = 0ul;
+    auto elapsed = Clock::duration{};
+    for (auto sent = 0ul; sent < packets; sent += rounds * numBenchTopics) {
+        for (auto round = 0; round < rounds; ++round) {
+            for (const auto& topic : benchTopics) {
+                ++payload[0];
+                publisher.publish(topic.topic, payload, topic.size);
+            }
+        }
+
+        const auto start = Clock::now();
+        {
+            AllocationCounter counter;
+            plankton.poll();
+            for (const auto& topic : benchTopics) {
+                plankton.read(topic.topic, data, sizeof(data));
+            }
+        }
+        elapsed += Clock::now() - start;
+        received += rounds * numBenchTopics;
+    }
+    const auto result = TableResult{received / seconds(elapsed), allocations};
+    allocations = 0;
+    return result;
+}
+
+static void benchTable(unsigned long packets) {
+    const auto fixed = runTable<Plankton>(packets);
+    const auto legacy = runTable<LegacyPlankton>(packets);
+
+    printf("table: %lu packets of %zu topics\n", packets, numBenchTopics);
+    printf("  %-10s %12.0f packets/s  %6lu allocations in poll/read\n", "plankton", fixed.packetsPerSecond, fixed.allocations);
+    printf("  %-10s %12.0f packets/s  %6lu allocations in poll/read\n", "map", legacy.packetsPerSecond, legacy.allocations);
+}
+
+// Delivery
+
+/// Messages published in a row before the subscriber catches up - as a tick publishing all its topics would.
+static constexpr unsigned deliveryBurst = 8;
+
+struct DeliveryResult {
+    unsigned long received;
+    unsigned long lost;
+    double messagesPerSecond;
+    double p50Micros;
+    double p99Micros;
+};
+
+/// Floods the RANGE and JOYSTICK topics in bursts and takes the time each message needs until it can be read.
+///
+/// The subscriber polls a single datagram at a time so that no sample gets overwritten before it got read.
+/// Each payload starts with the index of the message, which tells when it got published. If `socket` is given,
+/// the subscriber waits on it for the datagrams to arrive.
+static DeliveryResult runDelivery(PlanktonTransport& publisherTransport, PlanktonTransport& subscriberTransport,
+                                  SocketTransport* socket, unsigned long messages) {
+    const auto& range = benchTopics[0];
+    const auto& joystick = benchTopics[1];
+
+    Plankton publisher{publisherTransport};
+    Plankton plankton{subscriberTransport};
+    publisher.begin();
+    plankton.begin();
+    publisher.advertise(range.topic, {true, true, 0, false});
+    publisher.advertise(joystick.topic, {false, true, 0, false});
+    plankton.subscribe(range.topic, {0});
+    plankton.subscribe(joystick.topic, {0});
+
+    auto sendTimes = std::vector<Clock::time_point>(0x10000);
+    auto latencies = std::vector<double>{};
+    latencies.reserve(messages);
+    uint32_t counts[2] = {};
+    uint8_t payload[Plankton::maxPayload] = {};
+    auto index = uint16_t{};
+    auto lost = 0ul;
+
+    const auto start = Clock::now();
+    for (auto sent = 0ul; sent < messages; sent += deliveryBurst) {
+        for (auto i = 0u; i < deliveryBurst; ++i) {
+            const auto& topic = i % 2 == 0 ? range : joystick;
+            memcpy(payload, &index, sizeof(index));
+            sendTimes[index] = Clock::now();
+            publisher.publish(topic.topic, payload, topic.size);
+            ++index;
+        }
+
+        auto pending = deliveryBurst;
+        while (pending > 0) {
+            if (socket != nullptr && !socket->wait(100)) {
+                lost += pending;
+                break;
+            }
+            auto morePending = false;
+            if (!plankton.poll(Plankton::PollBudget{1, 0}, morePending)) {
+                if (socket == nullptr) {
+                    lost += pending;
+                    break;
+                }
+                continue;
+            }
+            const auto now = Clock::now();
+            for (auto i = 0; i < 2; ++i) {
+                const auto topic = i == 0 ? range.topic : joystick.topic;
+                auto info = Plankton::SampleInfo{};
+                if (!plankton.describe(topic, info) || info.count == counts[i]) {
+                    continue;
+                }
+                counts[i] = info.count;
+                auto received = uint16_t{};
+                plankton.read(topic, payload, sizeof(received));
+                memcpy(&received, payload, sizeof(received));
+                latencies.push_back(std::chrono::duration<double, std::micro>(now - sendTimes[received]).count());
+                --pending;
+            }
+        }
+    }
+    const auto elapsed = Clock::now() - start;
+
+    auto result = DeliveryResult{latencies.size(), lost, latencies.size() / seconds(elapsed), 0, 0};
+    if (!latencies.empty()) {
+        std::sort(latencies.begin(), latencies.end());
+        result.p50Micros = latencies[latencies.size() / 2];
+        result.p99Micros = latencies[std::min(latencies.size() - 1, latencies.size() * 99 / 100)];
+    }
+    return result;
+}
+
+static void printDelivery(const char* name, const DeliveryResult& result) {
+    printf("  %-10s %12.0f msgs/s  latency p50 %8.1f us  p99 %8.1f us  (%lu received, %lu lost)\n",
+           name, result.messagesPerSecond, result.p50Micros, result.p99Micros, result.received, result.lost);
+}
+
+static void benchDelivery(unsigned long messages) {
+    printf("delivery: %lu messages in bursts of %u\n", messages, deliveryBurst);
+    {
+        LoopbackBus bus;
+        LoopbackTransport publisher{bus};
+        LoopbackTransport subscriber{bus};
+        printDelivery("loopback", runDelivery(publisher, subscriber, nullptr, messages));
+    }
+    {
+        // Unicasts and broadcasts to the loopback address reach only one of the sockets sharing the port,
+        // which is why the topics get multicast. The system calls are slower, so a tenth of the messages do.
+        SocketTransport publisher{INADDR_LOOPBACK};
+        SocketTransport subscriber{INADDR_LOOPBACK};
+        printDelivery("socket", runDelivery(publisher, subscriber, &subscriber, messages / 10));
+    }
+}
+
+// Driver
+
+int main(int argc, char* argv[]) {
+    auto packets = 1000000ul;
+    for (auto i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            packets = strtoul(argv[++i], nullptr, 10);
+        } else {
+            fprintf(stderr, "usage: %s [-n packets]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    benchLookup(packets);
+    benchTable(packets);
+    benchDelivery(packets);
+    return 0;
+}
@@ -3,6 +3,7 @@
 void AtomMotion::Init()		
 {
 	Wire.begin(25, 21);
+	InvalidateServoPulses();
 }
 
 void AtomMotion::Write1Byte(uint8_t address,uint8_t Register_address,uint8_t data)
@@ -13,14 +14,22 @@ void AtomMotion::Write1Byte(uint8_t address,uint8_t Register_address,uint8_t dat
   Wire.endTransmission();
 }
 
-void AtomMotion::Write2Byte(uint8_t address,uint8_t Register_address,uint16_t data)
+bool AtomMotion::Write2Byte(uint8_t address,uint8_t Register_address,uint16_t data)
 {
   Wire.beginTransmission(address);
   Wire.write(Register_address);
   Wire.write(data >> 8); //MSB
   Wire.write(data & 0xFF); //LSB
   
-  Wire.endTransmission();
+  return Wire.endTransmission() == 0;
+}
+
+bool AtomMotion::WriteBytes(uint8_t address,uint8_t Register_address,const uint8_t * data,uint8_t count)
+{
+  Wire.beginTransmission(address);
+  Wire.write(Register_address);     // The register address auto-increments with each byte
+  Wire.write(data, count);
+  return Wire.endTransmission() == 0;
 }
 
 
@@ -29,11 +38,11 @@ uint8_t AtomMotion::ReadBytes(uint8_t address, uint8_t subAddress, uint8_t count
   Wire.beginTransmission(address);   // Initialize the Tx buffer
   Wire.write(subAddress);            // Put slave register address in Tx buffer
   uint8_t i = 0;
-  if (Wire.endTransmission(false) == 0 && Wire.requestFrom(address, (uint8_t)count)) {
-    while (Wire.available()) {
+  if (Wire.endTransmission(false) == 0 && Wire.requestFrom(address, (uint8_t)count) == count) {
+    while (Wire.available() && i < count) {
 		dest[i++]=Wire.read();
     }
-    return true;
+    return i == count;
   }
   return false;
 }
@@ -58,10 +67,76 @@ uint8_t AtomMotion::SetServoPulse(uint8_t Servo_CH,uint16_t width)    //0x10
 	uint8_t Register_address=2*servo_ch+16;
 	if(Register_address%2==1 || Register_address>32)
 		return 1;
-	Write2Byte(SERVO_ADDRESS,Register_address,width);
+	const uint8_t bit = 1 << servo_ch;
+	if((pulseCached & bit) && pulseCache[servo_ch] == width)
+		return 0;
+	if(!Write2Byte(SERVO_ADDRESS,Register_address,width)) {
+		pulseCached &= ~bit;
+		return 1;
+	}
+	pulseCache[servo_ch] = width;
+	pulseCached |= bit;
+	return 0;
+}
+
+uint8_t AtomMotion::SetServoPulses(uint8_t mask, const uint16_t * widths)
+{
+	// Find the range of channels which need a write
+	uint8_t first = SERVO_NUM, last = 0, changed = 0;
+	for(uint8_t ch = 0; ch < SERVO_NUM; ch++) {
+		const uint8_t bit = 1 << ch;
+		if((mask & bit) && (!(pulseCached & bit) || pulseCache[ch] != widths[ch])) {
+			changed |= bit;
+			if(first == SERVO_NUM)
+				first = ch;
+			last = ch;
+		}
+	}
+	if(!changed)
+		return 0;
+
+	// The channels in between get their current pulse - read it once if it is not known yet
+	uint8_t data[2 * SERVO_NUM];
+	uint8_t count = 0;
+	for(uint8_t ch = first; ch <= last; ch++) {
+		const uint8_t bit = 1 << ch;
+		uint16_t width;
+		if(changed & bit) {
+			width = widths[ch];
+		} else {
+			if(!(pulseCached & bit))
+				ReadServoPulse(ch + 1);
+			if(!(pulseCached & bit)) {
+				// Cannot burst over an unknown pulse - write the changed channels one by one
+				uint8_t result = 0;
+				for(uint8_t i = first; i <= last; i++)
+					if(changed & (1 << i))
+						result |= SetServoPulse(i + 1, widths[i]);
+				return result;
+			}
+			width = pulseCache[ch];
+		}
+		data[count++] = width >> 8;   //MSB
+		data[count++] = width & 0xFF; //LSB
+	}
+
+	const uint8_t range = ((1 << (last + 1)) - 1) & ~((1 << first) - 1);
+	if(!WriteBytes(SERVO_ADDRESS,2*first+16,data,count)) {
+		pulseCached &= ~range;
+		return 1;
+	}
+	for(uint8_t ch = first; ch <= last; ch++)
+		if(changed & (1 << ch))
+			pulseCache[ch] = widths[ch];
+	pulseCached |= range;
 	return 0;
 }
 
+void AtomMotion::InvalidateServoPulses(uint8_t mask)
+{
+	pulseCached &= ~mask;
+}
+
 uint8_t AtomMotion::SetMotorSpeed(uint8_t Motor_CH, int8_t speed)    //0x10        ->16
 {
 	uint8_t servo_ch =	Motor_CH-1;
@@ -82,12 +157,23 @@ uint8_t AtomMotion::ReadServoAngle(uint8_t Servo_CH)
 }
 
 uint16_t AtomMotion::ReadServoPulse(uint8_t Servo_CH)
+{
+	uint16_t width=0;
+	ReadServoPulse(Servo_CH,width);
+	return width;
+}
+
+bool AtomMotion::ReadServoPulse(uint8_t Servo_CH, uint16_t &width)
 {
 	uint8_t data[2];
 	uint8_t servo_ch =	Servo_CH-1;
 	uint8_t Register_address=2*servo_ch | 0x10;
-	ReadBytes(SERVO_ADDRESS,Register_address,2,data);
-  return  (data[0]<<8)+data[1];
+	if(servo_ch>=SERVO_NUM || !ReadBytes(SERVO_ADDRESS,Register_address,2,data))
+		return false;
+	width = (data[0]<<8)+data[1];
+	pulseCache[servo_ch] = width;
+	pulseCached |= 1 << servo_ch;
+	return true;
 }
 
 int8_t AtomMotion::ReadMotorSpeed(uint8_t Motor_CH)
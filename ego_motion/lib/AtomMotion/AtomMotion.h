@@ -1,28 +1,53 @@
+#pragma once
+
 #include <M5Atom.h>
 
 #define SERVO_ADDRESS	0X38
 
+#define SERVO_NUM	4
+
+// Bit of a channel in the mask of SetServoPulses
+#define SERVO_CH(ch)	(1 << ((ch) - 1))
+
 
 class AtomMotion
 {
 private:
     void Write1Byte(uint8_t address,uint8_t Register_address,uint8_t data);
-    void Write2Byte(uint8_t address,uint8_t Register_address,uint16_t data);
+    bool Write2Byte(uint8_t address,uint8_t Register_address,uint16_t data);
+    bool WriteBytes(uint8_t address,uint8_t Register_address,const uint8_t * data,uint8_t count);
     uint8_t ReadBytes(uint8_t address, uint8_t subAddress, uint8_t count,uint8_t * dest);
+
+    // Last pulses known to be in the registers - bit CH-1 of pulseCached is set if pulseCache[CH-1] is valid
+    uint16_t pulseCache[SERVO_NUM] = {};
+    uint8_t pulseCached = 0;
 public:
 
-    void Init(); //sda  25     scl  21 		
+    void Init(); //sda  25     scl  21 - forgets the last written pulses	
 
     uint8_t SetServoAngle(uint8_t Servo_CH, uint8_t angle);
 
     uint8_t SetServoPulse(uint8_t Servo_CH, uint16_t width);
 
+    // Sets the pulses of all channels in mask (see SERVO_CH) in a single auto-increment burst -
+    // widths holds one pulse per channel from 1 to SERVO_NUM, of which only those in mask are used.
+    // Pulses which did not change since the last write are skipped, so are the channels outside
+    // of the changed ones. Channels in between get their last known pulse rewritten.
+    uint8_t SetServoPulses(uint8_t mask, const uint16_t * widths);
+
+    // Forgets the last written pulses of the channels in mask (see SERVO_CH) - of all channels by default,
+    // e.g. after the servo controller got reset.
+    void InvalidateServoPulses(uint8_t mask = 0xFF);
+
     uint8_t SetMotorSpeed(uint8_t Motor_CH, int8_t speed);
 
     uint8_t ReadServoAngle(uint8_t Servo_CH);
 
     uint16_t ReadServoPulse(uint8_t Servo_CH);
 
+    // Returns false instead of a pulse of 0 if the read failed.
+    bool ReadServoPulse(uint8_t Servo_CH, uint16_t &width);
+
     int8_t ReadMotorSpeed(uint8_t Motor_CH);
 
 };
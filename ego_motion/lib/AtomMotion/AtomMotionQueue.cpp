@@ -0,0 +1,136 @@
+// Copyright (c) 2022, Framework Labs.
+
+#include "AtomMotionQueue.h"
+
+#include <cstring>
+
+AtomMotionQueue::AtomMotionQueue(AtomMotion& motion, BaseType_t core, UBaseType_t priority)
+    : motion_{motion}, core_{core}, priority_{priority} {}
+
+bool AtomMotionQueue::Begin() {
+    if (task_ != nullptr) {
+        return true;
+    }
+    return xTaskCreatePinnedToCore(Run, "motion", ATOM_MOTION_QUEUE_STACK, this, priority_, &task_, core_) == pdPASS;
+}
+
+AtomMotionQueue::Ticket AtomMotionQueue::SubmitServoPulses(uint8_t mask, const uint16_t* widths, bool rewrite) {
+    const auto slot = Reserve(Op::SERVO_PULSES);
+    if (slot == nullptr) {
+        return 0;
+    }
+    slot->channel = mask;
+    slot->rewrite = rewrite;
+    memcpy(slot->values, widths, sizeof(slot->values));
+    return Commit(*slot);
+}
+
+AtomMotionQueue::Ticket AtomMotionQueue::SubmitMotorSpeed(uint8_t Motor_CH, int8_t speed) {
+    const auto slot = Reserve(Op::MOTOR_SPEED);
+    if (slot == nullptr) {
+        return 0;
+    }
+    slot->channel = Motor_CH;
+    slot->values[0] = uint16_t(speed);
+    return Commit(*slot);
+}
+
+AtomMotionQueue::Ticket AtomMotionQueue::SubmitReadServoPulse(uint8_t Servo_CH) {
+    const auto slot = Reserve(Op::READ_SERVO_PULSE);
+    if (slot == nullptr) {
+        return 0;
+    }
+    slot->channel = Servo_CH;
+    return Commit(*slot);
+}
+
+AtomMotionQueue::Status AtomMotionQueue::Poll(Ticket ticket) const {
+    if (ticket == 0) {
+        return FAILED;
+    }
+    if (int32_t(ticket - completed_.load(std::memory_order_acquire)) > 0) {
+        return PENDING;
+    }
+    const auto slot = Completed(ticket);
+    if (slot == nullptr) {
+        return EXPIRED;
+    }
+    return slot->ok ? DONE : FAILED;
+}
+
+bool AtomMotionQueue::ReadResult(Ticket ticket, uint16_t& width) const {
+    if (Poll(ticket) != DONE) {
+        return false;
+    }
+    const auto slot = Completed(ticket);
+    if (slot->op != Op::READ_SERVO_PULSE) {
+        return false;
+    }
+    width = slot->values[0];
+    return true;
+}
+
+bool AtomMotionQueue::IsIdle() const {
+    return completed_.load(std::memory_order_acquire) == submitted_.load(std::memory_order_relaxed);
+}
+
+AtomMotionQueue::Slot* AtomMotionQueue::Reserve(Op op) {
+    const auto submitted = submitted_.load(std::memory_order_relaxed);
+    if (task_ == nullptr || submitted - completed_.load(std::memory_order_acquire) == depth) {
+        return nullptr;
+    }
+    // Ticket 0 means not submitted, so ticket n lives in slot n % depth.
+    auto& slot = slots_[(submitted + 1) % depth];
+    slot.op = op;
+    slot.ok = false;
+    return &slot;
+}
+
+AtomMotionQueue::Ticket AtomMotionQueue::Commit(Slot& slot) {
+    const auto ticket = submitted_.load(std::memory_order_relaxed) + 1;
+    slot.ticket = ticket;
+    submitted_.store(ticket, std::memory_order_release);
+    xTaskNotifyGive(task_);
+    return ticket;
+}
+
+const AtomMotionQueue::Slot* AtomMotionQueue::Completed(Ticket ticket) const {
+    // Only the tick loop reuses slots, so a completed slot stays put while the tick loop looks at it.
+    const auto& slot = slots_[ticket % depth];
+    return slot.ticket == ticket ? &slot : nullptr;
+}
+
+void AtomMotionQueue::Run(void* self) {
+    static_cast<AtomMotionQueue*>(self)->Loop();
+}
+
+void AtomMotionQueue::Loop() {
+    while (true) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+        auto completed = completed_.load(std::memory_order_relaxed);
+        while (completed != submitted_.load(std::memory_order_acquire)) {
+            auto& slot = slots_[(completed + 1) % depth];
+            switch (slot.op) {
+                case Op::SERVO_PULSES:
+                    if (slot.rewrite) {
+                        // Only the rewritten channels - the burst keeps the cached pulses of those in between.
+                        motion_.InvalidateServoPulses(slot.channel);
+                    }
+                    slot.ok = motion_.SetServoPulses(slot.channel, slot.values) == 0;
+                    if (!slot.ok) {
+                        // The controller may have been reset along with the failure - trust none of the pulses.
+                        motion_.InvalidateServoPulses();
+                    }
+                    break;
+                case Op::MOTOR_SPEED:
+                    slot.ok = motion_.SetMotorSpeed(slot.channel, int8_t(slot.values[0])) == 0;
+                    break;
+                case Op::READ_SERVO_PULSE:
+                    slot.ok = motion_.ReadServoPulse(slot.channel, slot.values[0]);
+                    break;
+            }
+            completed_.store(++completed, std::memory_order_release);
+        }
+    }
+}
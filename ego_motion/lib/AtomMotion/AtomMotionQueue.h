@@ -0,0 +1,93 @@
+// AtomMotionQueue
+//
+// Copyright (c) 2022, Framework Labs.
+
+#pragma once
+
+#include "AtomMotion.h"
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#include <atomic>
+
+#ifndef ATOM_MOTION_QUEUE_DEPTH
+#define ATOM_MOTION_QUEUE_DEPTH 8
+#endif
+
+#ifndef ATOM_MOTION_QUEUE_STACK
+#define ATOM_MOTION_QUEUE_STACK 2048
+#endif
+
+/// Does the I2C transactions of an `AtomMotion` in a FreeRTOS task of its own.
+///
+/// Submitting only fills a slot of a lock-free ring and wakes the task, so a slow or NACKing servo
+/// controller never stalls the tick. Each submission returns a ticket to poll for completion on later
+/// ticks. Submit and poll from a single thread - the tick loop - and leave all other calls of the
+/// `AtomMotion` to the queue once it got begun.
+class AtomMotionQueue {
+public:
+    static constexpr uint32_t depth = ATOM_MOTION_QUEUE_DEPTH;
+
+    /// Identifies a submission - 0 if it did not fit into the queue.
+    using Ticket = uint32_t;
+
+    enum Status : uint8_t {
+        PENDING,
+        DONE,
+        FAILED,     ///< The transaction failed or never got submitted.
+        EXPIRED     ///< Too many later submissions completed to still know the outcome.
+    };
+
+    explicit AtomMotionQueue(AtomMotion& motion, BaseType_t core = 1, UBaseType_t priority = 2);
+
+    AtomMotionQueue(const AtomMotionQueue&) = delete;
+    AtomMotionQueue& operator=(const AtomMotionQueue&) = delete;
+
+    bool Begin();
+
+    /// Queues `AtomMotion::SetServoPulses` - `widths` gets copied. With `rewrite`, the pulses in `mask` get
+    /// written even if they did not change, in case the servo controller lost them.
+    Ticket SubmitServoPulses(uint8_t mask, const uint16_t* widths, bool rewrite = false);
+    Ticket SubmitMotorSpeed(uint8_t Motor_CH, int8_t speed);
+    Ticket SubmitReadServoPulse(uint8_t Servo_CH);
+
+    Status Poll(Ticket ticket) const;
+
+    /// The pulse read by a completed `SubmitReadServoPulse`.
+    bool ReadResult(Ticket ticket, uint16_t& width) const;
+
+    /// Whether all submissions completed.
+    bool IsIdle() const;
+
+private:
+    enum class Op : uint8_t {
+        SERVO_PULSES,
+        MOTOR_SPEED,
+        READ_SERVO_PULSE
+    };
+
+    struct Slot {
+        Ticket ticket;
+        Op op;
+        uint8_t channel;    ///< Mask for SERVO_PULSES.
+        bool rewrite;       ///< Forget the written pulses of the masked channels first for SERVO_PULSES.
+        bool ok;
+        uint16_t values[SERVO_NUM];
+    };
+
+    Slot* Reserve(Op op);
+    Ticket Commit(Slot& slot);
+    const Slot* Completed(Ticket ticket) const;
+
+    static void Run(void* self);
+    void Loop();
+
+    AtomMotion& motion_;
+    BaseType_t core_;
+    UBaseType_t priority_;
+    TaskHandle_t task_ = nullptr;
+    Slot slots_[depth];
+    std::atomic<uint32_t> submitted_{0};    ///< Written by the tick loop only.
+    std::atomic<uint32_t> completed_{0};    ///< Written by the task only.
+};
@@ -0,0 +1,117 @@
+// ServoTable
+//
+// Copyright (c) 2022, Framework Labs.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+/// The pulse in µs which stops a servo of the Servo Kit 360 - give or take its deadband.
+constexpr uint16_t SERVO_NEUTRAL = 1500;
+
+/// A table has a point for every this many % of speed from -100 to 100.
+constexpr int SERVO_TABLE_STEP = 25;
+constexpr size_t SERVO_TABLE_POINTS = 2 * 100 / SERVO_TABLE_STEP + 1;
+
+/// A speed in mm/s measured while driving a servo with a pulse.
+struct ServoSample {
+    uint16_t pulse;
+    int16_t speed;
+};
+
+/// Maps the speed of a wheel to the pulse driving its servo at that speed.
+///
+/// The curve of the Servo Kit 360 is far from linear and the deadband around the neutral pulse differs from
+/// servo to servo - so each servo gets a table of its own which is interpolated in between the points.
+/// Plain C++ without Arduino so that it runs on the host too.
+struct ServoTable {
+    /// The pulses for the speeds -100, -75, .. 100 - a negative speed drives the robot backwards.
+    uint16_t pulses[SERVO_TABLE_POINTS];
+
+    /// The table of a servo whose speed changes by 1 % every 4 µs - `direction` is -1 if it got mounted
+    /// mirrored so that lower pulses drive the robot forward.
+    static ServoTable linear(int16_t trim, int direction) {
+        auto table = ServoTable{};
+        for (size_t i = 0; i < SERVO_TABLE_POINTS; ++i) {
+            const auto speed = int(i) * SERVO_TABLE_STEP - 100;
+            table.pulses[i] = uint16_t(SERVO_NEUTRAL + trim + direction * speed * 4);
+        }
+        return table;
+    }
+
+    /// The pulse for `speed` given in 0.1 % from -1000 to 1000.
+    uint16_t pulse(int speed) const {
+        constexpr auto step = SERVO_TABLE_STEP * 10;
+        speed = speed < -1000 ? -1000 : speed > 1000 ? 1000 : speed;
+        const auto i = size_t(speed + 1000) / step;
+        if (i + 1 == SERVO_TABLE_POINTS) {
+            return pulses[i];
+        }
+        const auto offset = speed + 1000 - int(i) * step;
+        return uint16_t(pulses[i] + (int(pulses[i + 1]) - int(pulses[i])) * offset / step);
+    }
+
+    /// Whether the pulses are within what the servo takes and do not change direction.
+    bool isValid() const {
+        const auto direction = pulses[SERVO_TABLE_POINTS - 1] > pulses[0] ? 1 : -1;
+        for (size_t i = 0; i < SERVO_TABLE_POINTS; ++i) {
+            if (pulses[i] < 500 || pulses[i] > 2500) {
+                return false;
+            }
+            if (i > 0 && (int(pulses[i]) - int(pulses[i - 1])) * direction < 0) {
+                return false;
+            }
+        }
+        return pulses[0] != pulses[SERVO_TABLE_POINTS - 1];
+    }
+
+    /// Fills the half of the table for one direction from `samples` taken while driving the servo into that
+    /// direction - ordered from `neutral` outwards with the speeds as magnitudes. `neutral` is the pulse the
+    /// servo stands still at, ideally the middle of its deadband. Speeds below `minSpeed` count as standing
+    /// still, so the deadband gets skipped. The speed of 100 % becomes `top`, which should be the lowest top
+    /// speed of all servos and directions so that each of them can keep up. Returns false if the samples do
+    /// not reach `top`.
+    bool fill(bool forward, uint16_t neutral, const ServoSample* samples, size_t count, int16_t top, int16_t minSpeed) {
+        constexpr auto center = SERVO_TABLE_POINTS / 2;
+        pulses[center] = neutral;
+        if (top < minSpeed) {
+            return false;
+        }
+
+        // Walk the samples outwards - the speeds might go down again a little at the top, so only take faster ones.
+        auto prev = ServoSample{neutral, 0};
+        auto cur = prev;
+        size_t next = 0;
+        for (size_t step = 1; step <= center; ++step) {
+            const auto target = int(top) * int(step) / int(center);
+            while (cur.speed < target) {
+                if (next == count) {
+                    return false;
+                }
+                const auto& sample = samples[next++];
+                if (sample.speed < minSpeed) {
+                    if (cur.speed == 0) {
+                        cur = ServoSample{sample.pulse, 0};
+                    }
+                } else if (sample.speed > cur.speed) {
+                    prev = cur;
+                    cur = sample;
+                }
+            }
+            const auto pulse = int(prev.pulse) + (int(cur.pulse) - int(prev.pulse)) * (target - prev.speed) /
+                                                 (cur.speed - prev.speed);
+            pulses[forward ? center + step : center - step] = uint16_t(pulse);
+        }
+        return true;
+    }
+};
+
+/// The highest of the speeds of `samples`.
+inline int16_t topSpeed(const ServoSample* samples, size_t count) {
+    auto top = int16_t{0};
+    for (size_t i = 0; i < count; ++i) {
+        top = samples[i].speed > top ? samples[i].speed : top;
+    }
+    return top;
+}
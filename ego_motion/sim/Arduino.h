@@ -0,0 +1,87 @@
+// Arduino stand-in for the host simulation.
+//
+// Copyright (c) 2022, Framework Labs.
+
+#pragma once
+
+#include "sim.h"
+
+#include <algorithm>
+#include <cstdarg>
+#include <cstdint>
+#include <cstdio>
+
+using std::min;
+using std::max;
+
+// Timing
+
+inline uint32_t millis() {
+    return uint32_t(sim::nowMicros / 1000);
+}
+
+inline uint32_t micros() {
+    return uint32_t(sim::nowMicros);
+}
+
+inline bool setCpuFrequencyMhz(uint32_t /*mhz*/) {
+    return true;
+}
+
+// FreeRTOS - as on the ESP32 one tick lasts a millisecond.
+
+using TickType_t = uint32_t;
+
+inline TickType_t xTaskGetTickCount() {
+    return millis();
+}
+
+inline void vTaskDelay(TickType_t ticks) {
+    sim::nowMicros += uint64_t{ticks} * 1000;
+}
+
+inline void vTaskDelayUntil(TickType_t* prevWakeTime, TickType_t increment) {
+    *prevWakeTime += increment;
+    const auto remaining = TickType_t(*prevWakeTime - xTaskGetTickCount());
+    if (remaining <= increment) {
+        vTaskDelay(remaining);
+    }
+}
+
+// Serial
+
+class HardwareSerial {
+public:
+    void begin(unsigned long /*baud*/) {}
+
+    void print(const char* str) {
+        if (sim::serialOut != nullptr) {
+            fputs(str, sim::serialOut);
+        }
+    }
+
+    void print(char c) {
+        if (sim::serialOut != nullptr) {
+            fputc(c, sim::serialOut);
+        }
+    }
+
+    void println(const char* str = "") {
+        if (sim::serialOut != nullptr) {
+            fputs(str, sim::serialOut);
+            fputc('\n', sim::serialOut);
+        }
+    }
+
+    __attribute__((format(printf, 2, 3)))
+    void printf(const char* format, ...) {
+        if (sim::serialOut != nullptr) {
+            va_list args;
+            va_start(args, format);
+            vfprintf(sim::serialOut, format, args);
+            va_end(args);
+        }
+    }
+};
+
+extern HardwareSerial Serial;
@@ -0,0 +1,77 @@
+// AtomMotion stand-in for the host simulation.
+//
+// Copyright (c) 2022, Framework Labs.
+
+#pragma once
+
+#include <M5Atom.h>
+
+#define SERVO_ADDRESS	0X38
+
+#define SERVO_NUM	4
+
+#define SERVO_CH(ch)	(1 << ((ch) - 1))
+
+/// Keeps the commanded servo pulses and motor speeds and traces every change of a pulse.
+class AtomMotion {
+public:
+    void Init() {}
+
+    uint8_t SetServoAngle(uint8_t Servo_CH, uint8_t angle) {
+        return SetServoPulse(Servo_CH, uint16_t(500 + angle * 2000 / 180));
+    }
+
+    uint8_t SetServoPulse(uint8_t Servo_CH, uint16_t width) {
+        if (Servo_CH < 1 || Servo_CH > numServos) {
+            return 1;
+        }
+        if (pulses_[Servo_CH - 1] != width) {
+            pulses_[Servo_CH - 1] = width;
+            sim::trace(sim::TraceKind::SERVO, Servo_CH, width);
+        }
+        return 0;
+    }
+
+    uint8_t SetServoPulses(uint8_t mask, const uint16_t* widths) {
+        for (uint8_t ch = 1; ch <= numServos; ++ch) {
+            if (mask & SERVO_CH(ch)) {
+                SetServoPulse(ch, widths[ch - 1]);
+            }
+        }
+        return 0;
+    }
+
+    void InvalidateServoPulses(uint8_t /*mask*/ = 0xFF) {}
+
+    uint8_t SetMotorSpeed(uint8_t Motor_CH, int8_t speed) {
+        if (Motor_CH < 1 || Motor_CH > numMotors) {
+            return 1;
+        }
+        speeds_[Motor_CH - 1] = speed;
+        return 0;
+    }
+
+    uint8_t ReadServoAngle(uint8_t Servo_CH) {
+        return uint8_t((ReadServoPulse(Servo_CH) - 500) * 180 / 2000);
+    }
+
+    uint16_t ReadServoPulse(uint8_t Servo_CH) {
+        return Servo_CH >= 1 && Servo_CH <= numServos ? pulses_[Servo_CH - 1] : 0;
+    }
+
+    bool ReadServoPulse(uint8_t Servo_CH, uint16_t& width) {
+        width = ReadServoPulse(Servo_CH);
+        return Servo_CH >= 1 && Servo_CH <= numServos;
+    }
+
+    int8_t ReadMotorSpeed(uint8_t Motor_CH) {
+        return Motor_CH >= 1 && Motor_CH <= numMotors ? speeds_[Motor_CH - 1] : 0;
+    }
+
+private:
+    static constexpr uint8_t numServos = SERVO_NUM;
+    static constexpr uint8_t numMotors = 2;
+
+    uint16_t pulses_[numServos] = {};
+    int8_t speeds_[numMotors] = {};
+};
@@ -0,0 +1,80 @@
+// AtomMotionQueue stand-in for the host simulation.
+//
+// Copyright (c) 2022, Framework Labs.
+
+#pragma once
+
+#include <AtomMotion.h>
+
+/// Runs each transaction right away when it gets submitted - so it is done on the first poll.
+class AtomMotionQueue {
+public:
+    using Ticket = uint32_t;
+
+    enum Status : uint8_t {
+        PENDING,
+        DONE,
+        FAILED,
+        EXPIRED
+    };
+
+    explicit AtomMotionQueue(AtomMotion& motion) : motion_(motion) {}
+
+    AtomMotionQueue(const AtomMotionQueue&) = delete;
+    AtomMotionQueue& operator=(const AtomMotionQueue&) = delete;
+
+    bool Begin() {
+        begun_ = true;
+        return true;
+    }
+
+    Ticket SubmitServoPulses(uint8_t mask, const uint16_t* widths, bool rewrite = false) {
+        if (rewrite) {
+            motion_.InvalidateServoPulses(mask);
+        }
+        return complete(motion_.SetServoPulses(mask, widths) == 0);
+    }
+
+    Ticket SubmitMotorSpeed(uint8_t Motor_CH, int8_t speed) {
+        return complete(motion_.SetMotorSpeed(Motor_CH, speed) == 0);
+    }
+
+    Ticket SubmitReadServoPulse(uint8_t Servo_CH) {
+        width_ = motion_.ReadServoPulse(Servo_CH);
+        return complete(true);
+    }
+
+    Status Poll(Ticket ticket) const {
+        if (ticket == 0 || (ticket == ticket_ && !ok_)) {
+            return FAILED;
+        }
+        return ticket == ticket_ ? DONE : EXPIRED;
+    }
+
+    bool ReadResult(Ticket ticket, uint16_t& width) const {
+        if (Poll(ticket) != DONE) {
+            return false;
+        }
+        width = width_;
+        return true;
+    }
+
+    bool IsIdle() const {
+        return true;
+    }
+
+private:
+    Ticket complete(bool ok) {
+        if (!begun_) {
+            return 0;
+        }
+        ok_ = ok;
+        return ++ticket_;
+    }
+
+    AtomMotion& motion_;
+    bool begun_ = false;
+    Ticket ticket_ = 0;
+    bool ok_ = false;
+    uint16_t width_ = 0;
+};
@@ -0,0 +1,96 @@
+// FastLED stand-in for the host simulation.
+//
+// Copyright (c) 2022, Framework Labs.
+
+#pragma once
+
+#include <Arduino.h>
+
+#include <cstring>
+
+struct CRGB {
+    enum HTMLColorCode : uint32_t {
+        Black = 0x000000,
+        Blue = 0x0000FF,
+        Green = 0x008000,
+        Orange = 0xFFA500,
+        Purple = 0x800080,
+        Red = 0xFF0000,
+        White = 0xFFFFFF,
+        Yellow = 0xFFFF00,
+    };
+
+    CRGB() : r{0}, g{0}, b{0} {}
+    CRGB(HTMLColorCode code) : r{uint8_t(code >> 16)}, g{uint8_t(code >> 8)}, b{uint8_t(code)} {}
+    CRGB(uint8_t r, uint8_t g, uint8_t b) : r{r}, g{g}, b{b} {}
+
+    uint32_t code() const {
+        return uint32_t{r} << 16 | uint32_t{g} << 8 | b;
+    }
+
+    bool operator==(const CRGB& other) const {
+        return r == other.r && g == other.g && b == other.b;
+    }
+
+    bool operator!=(const CRGB& other) const {
+        return !(*this == other);
+    }
+
+    uint8_t r;
+    uint8_t g;
+    uint8_t b;
+};
+
+template <uint8_t DATA_PIN> class NEOPIXEL {};
+
+/// Traces each LED whose color changed since the previous `show()`.
+class CFastLED {
+public:
+    static constexpr size_t maxStrips = 4;
+    static constexpr size_t maxLEDs = 16;
+
+    template <template <uint8_t> class CHIPSET, uint8_t DATA_PIN>
+    void addLeds(CRGB* leds, int count) {
+        if (numStrips_ == maxStrips || count < 0 || size_t(count) > maxLEDs) {
+            return;
+        }
+        auto& strip = strips_[numStrips_++];
+        strip.pin = DATA_PIN;
+        strip.leds = leds;
+        strip.count = size_t(count);
+    }
+
+    void setBrightness(uint8_t brightness) {
+        brightness_ = brightness;
+    }
+
+    uint8_t getBrightness() const {
+        return brightness_;
+    }
+
+    void show() {
+        for (size_t i = 0; i < numStrips_; ++i) {
+            auto& strip = strips_[i];
+            for (size_t j = 0; j < strip.count; ++j) {
+                if (strip.leds[j] != strip.shown[j]) {
+                    strip.shown[j] = strip.leds[j];
+                    sim::trace(sim::TraceKind::LED, uint16_t(strip.pin << 8 | j), strip.shown[j].code());
+                }
+            }
+        }
+    }
+
+private:
+    struct Strip {
+        uint8_t pin;
+        CRGB* leds;
+        size_t count;
+        CRGB shown[maxLEDs];
+    };
+
+    Strip strips_[maxStrips];
+    size_t numStrips_ = 0;
+    uint8_t brightness_ = 255;
+};
+
+extern CFastLED FastLED;
@@ -0,0 +1,26 @@
+// M5Atom stand-in for the host simulation.
+//
+// Copyright (c) 2022, Framework Labs.
+
+#pragma once
+
+#include <Arduino.h>
+#include <FastLED.h>
+#include <utility/Button.h>
+
+class M5Atom {
+public:
+    void begin(bool serialEnable = true, bool i2cEnable = true, bool displayEnable = false) {
+        (void)serialEnable;
+        (void)i2cEnable;
+        (void)displayEnable;
+    }
+
+    void update() {
+        Btn.read();
+    }
+
+    Button Btn{39, true, 10};
+};
+
+extern M5Atom M5;
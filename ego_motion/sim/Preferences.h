@@ -0,0 +1,52 @@
+// Preferences stand-in for the host simulation - the NVS starts out empty and lasts as long as the process.
+//
+// Copyright (c) 2022, Framework Labs.
+
+#pragma once
+
+#include <Arduino.h>
+
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+
+class Preferences {
+public:
+    bool begin(const char* name, bool readOnly = false) {
+        name_ = name;
+        readOnly_ = readOnly;
+        return true;
+    }
+
+    void end() {
+        name_.clear();
+    }
+
+    size_t getBytes(const char* key, void* buf, size_t maxLen) {
+        const auto it = storage().find(name_ + "/" + key);
+        if (it == storage().end() || it->second.size() > maxLen) {
+            return 0;
+        }
+        memcpy(buf, it->second.data(), it->second.size());
+        return it->second.size();
+    }
+
+    size_t putBytes(const char* key, const void* value, size_t len) {
+        if (readOnly_ || name_.empty()) {
+            return 0;
+        }
+        const auto bytes = static_cast<const uint8_t*>(value);
+        storage()[name_ + "/" + key].assign(bytes, bytes + len);
+        return len;
+    }
+
+private:
+    static std::map<std::string, std::vector<uint8_t>>& storage() {
+        static std::map<std::string, std::vector<uint8_t>> entries;
+        return entries;
+    }
+
+    std::string name_;
+    bool readOnly_ = false;
+};
@@ -0,0 +1,27 @@
+// WiFi stand-in for the host simulation - the connection is up right away.
+//
+// Copyright (c) 2022, Framework Labs.
+
+#pragma once
+
+#include <Arduino.h>
+
+class WiFiClass {
+public:
+    bool setHostname(const char* /*hostname*/) {
+        return true;
+    }
+
+    void begin(const char* /*ssid*/, const char* /*pass*/) {
+        connected_ = true;
+    }
+
+    bool isConnected() const {
+        return connected_;
+    }
+
+private:
+    bool connected_ = false;
+};
+
+extern WiFiClass WiFi;
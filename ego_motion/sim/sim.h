@@ -0,0 +1,32 @@
+// sim
+//
+// Copyright (c) 2022, Framework Labs.
+
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+
+// Shared state of the host simulation - the stand-ins for the Arduino, M5 and FastLED APIs
+// in this directory are backed by it and the driver in sim_main.cpp controls it.
+
+namespace sim {
+
+/// Virtual time in microseconds - only the driver advances it.
+extern uint64_t nowMicros;
+
+/// Receives the output of `Serial` - nothing is printed if null.
+extern FILE* serialOut;
+
+/// What the simulated hardware got commanded to do.
+enum class TraceKind : uint8_t {
+    SERVO,  ///< `index` is the servo channel, `value` the pulse width in us.
+    LED,    ///< `index` is the data pin << 8 | LED number, `value` the 0xRRGGBB color.
+    INTENT, ///< `value` is the published intent.
+    RANGE,  ///< `value` is the front range the ranger published in mm - traced on change.
+};
+
+/// Records a command - the driver writes the trace out once the run is over.
+void trace(TraceKind kind, uint16_t index, uint32_t value);
+
+} // namespace sim
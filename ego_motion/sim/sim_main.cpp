@@ -0,0 +1,964 @@
+// ego_motion simulation
+//
+// Copyright (c) 2022, Framework Labs.
+//
+// Runs the activities of ego_motion on the host against the stand-ins in this directory.
+// A scripted remote and ranger feed presses, joystick positions and ranges over a loopback
+// bus while the scheduler of ego_motion gets ticked as fast as possible on a virtual clock.
+//
+// Usage: program [-s script | -r recording ... | -b] [-n ticks] [-v]
+//
+// With -r, the inputs recorded on the robot by a build with EGO_RECORD get replayed instead of
+// running a script: the recording is either the binary stream or the "@rec" lines of Serial.
+// A recording of ego_motion runs its ticks again. Recordings of ego_ranger and ego_remote - one each,
+// started together - get replayed by the scripted peers instead: the raw ranges pass the filter of
+// the ranger and the buttons and joystick of the remote decide what it publishes, while ego_motion
+// ticks on its own. The datagrams ego_motion received already hold what the others published, so
+// its recording cannot be replayed along with theirs.
+//
+// The cost of the base ticks is reported on stderr, the trace of the servo pulses, LED colors
+// and intents is written as CSV to stdout.
+//
+// With -b, the speed profiles of ego_motion get benchmarked against the fixed-step filter they
+// replaced instead: for steps of the commanded speed, the time to get within 2 % of the target,
+// the overshoot and the peak jerk are reported on stderr.
+//
+// A script has one command per line, each prefixed by the virtual time in ms to run it at:
+//
+//   <ms> press short|double|long   - press the remote button
+//   <ms> button main|red|blue down|up
+//   <ms> joy <x> <y>               - joystick position from -100 to 100
+//   <ms> range <mm>                - ranges get published at 10 Hz from then on
+//   <ms> spike <mm>                - the next range only is off
+//   <ms> wall <mm>                 - place a wall ahead - ranges follow from how the servos move the robot
+//   <ms> norange                   - stop publishing ranges
+//
+// The scripted ranges pass the same filter as on the ranger - its cost gets reported on stderr too, as it does
+// for the raw ranges of a replayed ego_ranger recording.
+// With a wall, the closest approach and whether the robot hit it are reported as well.
+//
+// Empty lines and lines starting with # are ignored.
+
+#include "../src/main.cpp"
+
+#include "sim.h"
+
+#include <pa_record.h>
+#include <range_filter.h>
+#include <WiFi.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+// Stand-in Globals
+
+HardwareSerial Serial;
+CFastLED FastLED;
+M5Atom M5;
+WiFiClass WiFi;
+
+namespace sim {
+
+uint64_t nowMicros = 0;
+FILE* serialOut = nullptr;
+
+struct TraceEntry {
+    uint32_t time;
+    TraceKind kind;
+    uint16_t index;
+    uint32_t value;
+};
+
+static std::vector<TraceEntry> traceEntries;
+
+void trace(TraceKind kind, uint16_t index, uint32_t value) {
+    traceEntries.push_back({millis(), kind, index, value});
+}
+
+} // namespace sim
+
+// Script
+
+enum class Command : uint8_t {
+    PRESS,
+    BUTTON,
+    JOY,
+    RANGE,
+    SPIKE,
+    WALL,
+    NO_RANGE,
+};
+
+struct Event {
+    uint32_t time;
+    Command command;
+    int args[2];
+};
+
+static const char* defaultScript = R"(
+# Manual mode: drive ahead, turn left and right, back off
+1000 press short
+1500 range 2000
+2000 joy 0 60
+4000 joy -50 60
+6000 joy 50 60
+8000 range 60
+9000 joy 0 -40
+11000 joy 0 0
+12000 press short
+# Auto mode: approach an obstacle, turn until free again
+13000 button blue down
+13100 button blue up
+13200 button blue down
+13300 button blue up
+14000 range 1500
+18000 range 250
+20000 range 1200
+26000 norange
+28000 range 1500
+30000 button red down
+30100 button red up
+31000 press long
+)";
+
+static bool parseLine(const char* line, Event& event) {
+    char command[16] = {};
+    char arg[16] = {};
+    unsigned time = 0;
+    const auto n = sscanf(line, "%u %15s %15s", &time, command, arg);
+    if (n < 2) {
+        return false;
+    }
+    event = Event{time, {}, {}};
+
+    if (strcmp(command, "press") == 0 && n == 3) {
+        event.command = Command::PRESS;
+        if (strcmp(arg, "short") == 0) {
+            event.args[0] = int(Press::SHORT);
+        } else if (strcmp(arg, "double") == 0) {
+            event.args[0] = int(Press::DOUBLE);
+        } else if (strcmp(arg, "long") == 0) {
+            event.args[0] = int(Press::LONG);
+        } else {
+            return false;
+        }
+        return true;
+    }
+    if (strcmp(command, "button") == 0 && n == 3) {
+        char level[16] = {};
+        if (sscanf(line, "%*u %*s %*s %15s", level) != 1) {
+            return false;
+        }
+        event.command = Command::BUTTON;
+        if (strcmp(arg, "main") == 0) {
+            event.args[0] = 0;
+        } else if (strcmp(arg, "red") == 0) {
+            event.args[0] = 1;
+        } else if (strcmp(arg, "blue") == 0) {
+            event.args[0] = 2;
+        } else {
+            return false;
+        }
+        event.args[1] = strcmp(level, "down") == 0;
+        return event.args[1] || strcmp(level, "up") == 0;
+    }
+    if (strcmp(command, "joy") == 0) {
+        event.command = Command::JOY;
+        return sscanf(line, "%*u %*s %d %d", &event.args[0], &event.args[1]) == 2 &&
+               abs(event.args[0]) <= 100 && abs(event.args[1]) <= 100;
+    }
+    if (strcmp(command, "range") == 0) {
+        event.command = Command::RANGE;
+        return sscanf(line, "%*u %*s %d", &event.args[0]) == 1 && event.args[0] >= 0 && event.args[0] <= 0xFFFF;
+    }
+    if (strcmp(command, "spike") == 0) {
+        event.command = Command::SPIKE;
+        return sscanf(line, "%*u %*s %d", &event.args[0]) == 1 && event.args[0] >= 0 && event.args[0] <= 0xFFFF;
+    }
+    if (strcmp(command, "wall") == 0) {
+        event.command = Command::WALL;
+        return sscanf(line, "%*u %*s %d", &event.args[0]) == 1 && event.args[0] > 0 && event.args[0] <= 0xFFFF;
+    }
+    if (strcmp(command, "norange") == 0) {
+        event.command = Command::NO_RANGE;
+        return true;
+    }
+    return false;
+}
+
+static bool parseScript(FILE* file, const char* text, std::vector<Event>& events) {
+    char line[128];
+    auto lineNo = 0;
+    while (file != nullptr ? fgets(line, sizeof(line), file) != nullptr : *text != '\0') {
+        if (file == nullptr) {
+            const auto len = std::min(strcspn(text, "\n"), sizeof(line) - 1);
+            memcpy(line, text, len);
+            line[len] = '\0';
+            text += text[len] == '\n' ? len + 1 : len;
+        }
+        ++lineNo;
+        const auto start = line + strspn(line, " \t");
+        if (*start == '\0' || *start == '\n' || *start == '#') {
+            continue;
+        }
+        auto event = Event{};
+        if (!parseLine(start, event)) {
+            fprintf(stderr, "script line %d: cannot parse '%s'\n", lineNo, start);
+            return false;
+        }
+        events.push_back(event);
+    }
+    std::stable_sort(events.begin(), events.end(), [](const Event& lhs, const Event& rhs) {
+        return lhs.time < rhs.time;
+    });
+    return true;
+}
+
+// World
+
+/// Moves the robot by its servo pulses in front of a wall - what the ranger of the robot would see.
+///
+/// A servo drives its wheel at 1 % of `fullSpeed` per 4 us off the neutral pulse, beyond a deadband.
+/// Once the robot turned more than 60 degrees away from the wall, the wall is out of sight.
+class World {
+public:
+    static constexpr float fullSpeed = 500;     ///< mm/s
+    static constexpr float trackWidth = 100;    ///< mm
+    static constexpr uint16_t farRange = 2000;  ///< mm
+
+    void placeWall(uint16_t distance) {
+        distance_ = distance;
+        yaw_ = 0;
+        closest_ = distance;
+        hit_ = false;
+        placed_ = true;
+    }
+
+    /// Advances the robot by `dt` seconds.
+    void update(float dt) {
+        if (!placed_) {
+            return;
+        }
+        const auto left = wheelSpeed(motion.ReadServoPulse(1), leftServo);
+        const auto right = -wheelSpeed(motion.ReadServoPulse(3), rightServo);
+        yaw_ += (left - right) / trackWidth * dt;
+        if (inSight()) {
+            distance_ -= (left + right) / 2 * std::cos(yaw_) * dt;
+            closest_ = std::min(closest_, distance_);
+            hit_ = hit_ || distance_ <= 0;
+        }
+    }
+
+    uint16_t range() const {
+        return inSight() ? uint16_t(std::min(float(farRange), std::max(0.0f, distance_ / std::cos(yaw_)))) : farRange;
+    }
+
+    void printApproach() const {
+        if (placed_) {
+            fprintf(stderr, "wall: closest approach [mm]: %.0f%s, heading [deg]: %.0f\n", closest_,
+                    hit_ ? " - hit it" : "", yaw_ * 180 / 3.14159f);
+        }
+    }
+
+private:
+    /// Like real ones, the servos stop at pulses a little off the neutral one and differ in their deadband.
+    struct ServoModel {
+        int stop;       ///< µs from the neutral pulse
+        int deadband;   ///< µs to either side of the stop pulse
+    };
+
+    static constexpr ServoModel leftServo = {0, 20};
+    static constexpr ServoModel rightServo = {10, 35};
+
+    static float wheelSpeed(uint16_t pulse, const ServoModel& servo) {
+        const auto offset = int(pulse) - int(SERVO_NEUTRAL) - servo.stop;
+        if (pulse == 0 || abs(offset) <= servo.deadband) {
+            return 0;
+        }
+        return std::min(100.0f, std::max(-100.0f, offset / 4.0f)) * fullSpeed / 100;
+    }
+
+    bool inSight() const {
+        return std::fabs(yaw_) < 1.05f;
+    }
+
+    float distance_ = 0;
+    float yaw_ = 0;
+    float closest_ = 0;
+    bool hit_ = false;
+    bool placed_ = false;
+};
+
+constexpr World::ServoModel World::leftServo;
+constexpr World::ServoModel World::rightServo;
+
+// Remote and Ranger
+
+// A recorded cycle of the ranger that follows the previous one after longer than any profile takes means
+// the ranging got switched off in between - which restarts the filters.
+static constexpr uint32_t RANGER_RESTART_GAP = 500;
+
+// Each sample of a RAW_RANGES record as laid out on the ESP32.
+static constexpr size_t RAW_RANGE_SIZE = 8;
+
+// The display of the remote dims after this many ms without a press or a new intent.
+static constexpr uint32_t REMOTE_AWAKE_PERIOD = 5000;
+
+// Turns the replayed buttons of the remote into presses as on the remote.
+static pa_use(PressRecognizer2);
+
+/// Publishes what the remote and ranger nodes would and watches the intents of ego_motion.
+class ScriptedPeers {
+public:
+    ScriptedPeers() : plankton_{transport_} {}
+
+    void begin() {
+        plankton_.begin();
+        PressTopic::advertise(plankton_, {false, true, MOTION_CHANNEL, true});
+        JoystickTopic::advertise(plankton_, {true, true, MOTION_CHANNEL, false});
+        RangeTopic::advertise(plankton_, {true, true, MOTION_CHANNEL, false});
+        IntentTopic::subscribe(plankton_, {});
+    }
+
+    /// Sends a datagram recorded on the robot as if it came from the remote or ranger.
+    void inject(const uint8_t* data, size_t size) {
+        transport_.send(PlanktonTransport::broadcastAddr, data, size);
+    }
+
+    void apply(const Event& event) {
+        switch (event.command) {
+            case Command::PRESS:
+                press_ = Press(event.args[0]);
+                pressEndTime_ = millis() + 100;
+                PressTopic::publish(plankton_, press_);
+                break;
+            case Command::BUTTON: {
+                Button* buttons[] = {&M5.Btn, &redBtn, &blueBtn};
+                buttons[event.args[0]]->simulate(event.args[1] != 0);
+                break;
+            }
+            case Command::JOY:
+                joy_ = Speed{int8_t(event.args[0]), int8_t(event.args[1])};
+                JoystickTopic::publish(plankton_, joy_);
+                nextJoyTime_ = millis() + 100;
+                break;
+            case Command::RANGE:
+                range_ = uint16_t(event.args[0]);
+                ranging_ = true;
+                walled_ = false;
+                break;
+            case Command::SPIKE:
+                spike_ = uint16_t(event.args[0]);
+                spiking_ = true;
+                break;
+            case Command::WALL:
+                world_.placeWall(uint16_t(event.args[0]));
+                ranging_ = true;
+                walled_ = true;
+                break;
+            case Command::NO_RANGE:
+                ranging_ = false;
+                walled_ = false;
+                filter_.reset();
+                break;
+        }
+    }
+
+    /// Runs before each base tick of ego_motion.
+    void publish() {
+        const auto now = millis();
+        if (walled_) {
+            world_.update((now - worldTime_) / 1000.0f);
+            range_ = world_.range();
+        }
+        worldTime_ = now;
+
+        // Like the remote, which repeats a speed other than zero every 100 ms for it not to get stale.
+        if ((joy_.x != 0 || joy_.y != 0) && int32_t(now - nextJoyTime_) >= 0) {
+            JoystickTopic::publish(plankton_, joy_);
+            nextJoyTime_ = now + 100;
+        }
+
+        if (ranging_ && int32_t(now - nextRangeTime_) >= 0) {
+            const auto range = spiking_ ? spike_ : range_;
+            spiking_ = false;
+
+            const auto filtered = filterRange(filter_, range, now);
+
+            RangeTopic::publish(plankton_, Ranges{1, {filtered.confidence}, {filtered.range}, {filtered.rate},
+                                                  uint16_t(now - filtered.captureTime)});
+            nextRangeTime_ = now + 100;
+            if (filtered.range != tracedRange_) {
+                tracedRange_ = filtered.range;
+                sim::trace(sim::TraceKind::RANGE, 0, filtered.range);
+            }
+        }
+    }
+
+    /// Reports the cost of filtering the ranges, scripted or replayed - and how close the robot got to the wall.
+    void printFilterCost() {
+        world_.printApproach();
+        if (filterCosts_.empty()) {
+            return;
+        }
+        std::sort(filterCosts_.begin(), filterCosts_.end());
+        const auto n = filterCosts_.size();
+        fprintf(stderr, "range filter cost [ns]: %zu updates, p50 %u, p99 %u, max %u\n",
+                n, filterCosts_[n / 2], filterCosts_[n * 99 / 100], filterCosts_.back());
+    }
+
+    /// Replays a tick of ego_ranger - the raw ranges of a cycle pass a filter per sensor and get published
+    /// as the ranger does. The age of the ranges only covers the capture times of the cycle as the clock of the
+    /// ranger is unknown. Its button only switches the ranging on and off and it receives no datagrams - both
+    /// show in the cycles being recorded or not.
+    void replayRanger(const std::vector<RecordReader::Record>& records) {
+        for (const auto& record : records) {
+            if (record.type != RecordType::VALUE || record.size <= 1 || record.payload[0] != RAW_RANGES) {
+                continue;
+            }
+            const auto count = std::min(size_t{(record.size - 1u) / RAW_RANGE_SIZE}, size_t{MAX_RANGES});
+            if (count == 0) {
+                continue;
+            }
+            const auto samples = record.payload + 1;
+            const auto captureTime = recordU32(samples + 4);
+            if (count != rangerSensors_ || int32_t(captureTime - rangerCaptureTime_) > int32_t(RANGER_RESTART_GAP)) {
+                for (auto& filter : rangerFilters_) {
+                    filter.reset();
+                }
+                rangerSensors_ = count;
+            }
+            rangerCaptureTime_ = captureTime;
+
+            auto ranges = Ranges{uint8_t(count), {}, {}, {}, 0};
+            auto newest = captureTime;
+            auto oldest = captureTime;
+            for (size_t i = 0; i < count; ++i) {
+                const auto sample = samples + i * RAW_RANGE_SIZE;
+                const auto filtered = filterRange(rangerFilters_[i], recordU16(sample), recordU32(sample + 4));
+                ranges.confidence[i] = filtered.confidence;
+                ranges.mm[i] = filtered.range;
+                ranges.rate[i] = filtered.rate;
+                newest = int32_t(filtered.captureTime - newest) > 0 ? filtered.captureTime : newest;
+                oldest = int32_t(filtered.captureTime - oldest) < 0 ? filtered.captureTime : oldest;
+            }
+            ranges.age = uint16_t(std::min(newest - oldest, uint32_t{UINT16_MAX}));
+            RangeTopic::publish(plankton_, ranges);
+
+            const auto front = frontRange(ranges);
+            if (front != tracedRange_) {
+                tracedRange_ = front;
+                sim::trace(sim::TraceKind::RANGE, 0, front);
+            }
+        }
+    }
+
+    /// Replays a tick of ego_remote. Its buttons pass the same recognizer - where a press which only woke the
+    /// dimmed display gets dropped - and its joystick button stops unless stopped already. The joystick
+    /// position gets published while driving manually. The intents the remote received come from the
+    /// simulated ego_motion instead.
+    void replayRemote(const std::vector<RecordReader::Record>& records) {
+        for (const auto& record : records) {
+            switch (record.type) {
+                case RecordType::BUTTONS:
+                    if (record.size >= 1) {
+                        remoteBtnA_.simulate((record.payload[0] & 1) != 0);
+                        remoteBtnB_.simulate((record.payload[0] & 2) != 0);
+                    }
+                    break;
+                case RecordType::VALUE:
+                    if (record.size == 4 && record.payload[0] == RAW_JOYSTICK) {
+                        remoteJoy_ = Speed{int8_t(record.payload[1]), int8_t(record.payload[2])};
+                        remoteStopButton_ = record.payload[3] != 0;
+                    }
+                    break;
+                default:
+                    break;
+            }
+        }
+        remoteBtnA_.read();
+        remoteBtnB_.read();
+
+        auto rawPress = Press::NO;
+        pa_tick(PressRecognizer2, remoteBtnA_, remoteBtnB_, rawPress);
+        const auto now = millis();
+        auto press = now - remoteWakeTime_ >= REMOTE_AWAKE_PERIOD ? Press::NO : rawPress;
+        if (rawPress != Press::NO || intent_ != remoteIntent_) {
+            remoteWakeTime_ = now;
+        }
+        if (remoteStopButton_ && !remoteStopped_ && intent_ != Intent::STOP) {
+            press = Press::SHORT;
+        }
+        remoteStopped_ = remoteStopButton_;
+        if (press != remotePress_) {
+            remotePress_ = press;
+            PressTopic::publish(plankton_, press);
+        }
+
+        if (intent_ == Intent::START_MANU &&
+            (remoteIntent_ != Intent::START_MANU || remoteJoy_.x != joy_.x || remoteJoy_.y != joy_.y ||
+             remoteJoy_.x != 0 || remoteJoy_.y != 0)) {
+            joy_ = remoteJoy_;
+            JoystickTopic::publish(plankton_, joy_);
+        }
+        remoteIntent_ = intent_;
+    }
+
+    /// Runs after each base tick of ego_motion.
+    void receive() {
+        // Like the remote, which publishes its button every 100 ms, a press lasts for that long.
+        if (press_ != Press::NO && int32_t(millis() - pressEndTime_) >= 0) {
+            press_ = Press::NO;
+            PressTopic::publish(plankton_, press_);
+        }
+
+        plankton_.poll();
+        auto intent = Intent{};
+        auto info = Plankton::SampleInfo{};
+        if (IntentTopic::read(plankton_, intent, info) && info.count != intentCount_) {
+            intentCount_ = info.count;
+            intent_ = intent;
+            sim::trace(sim::TraceKind::INTENT, 0, uint32_t(intent));
+        }
+    }
+
+private:
+    /// Runs a range through a filter and takes the time it took.
+    FilteredRange filterRange(RangeFilter& filter, uint16_t range, uint32_t captureTime) {
+        const auto start = std::chrono::steady_clock::now();
+        const auto filtered = filter.update(range, captureTime);
+        const auto stop = std::chrono::steady_clock::now();
+        filterCosts_.push_back(uint32_t(std::chrono::duration_cast<std::chrono::nanoseconds>(stop - start).count()));
+        return filtered;
+    }
+
+    LoopbackTransport transport_{simBus};
+    Plankton plankton_;
+    Press press_ = Press::NO;
+    uint32_t pressEndTime_ = 0;
+    Speed joy_ = Speed{0, 0};
+    uint32_t nextJoyTime_ = 0;
+    uint16_t range_ = 0;
+    uint16_t spike_ = 0;
+    bool ranging_ = false;
+    bool spiking_ = false;
+    bool walled_ = false;
+    World world_;
+    uint32_t worldTime_ = 0;
+    uint16_t tracedRange_ = 0;
+    RangeFilter filter_;
+    std::vector<uint32_t> filterCosts_;
+    uint32_t nextRangeTime_ = 0;
+    uint32_t intentCount_ = 0;
+    Intent intent_ = Intent::STOP;
+    RangeFilter rangerFilters_[MAX_RANGES];
+    size_t rangerSensors_ = 0;
+    uint32_t rangerCaptureTime_ = 0;
+    Button remoteBtnA_{37, true, 10};
+    Button remoteBtnB_{39, true, 10};
+    Speed remoteJoy_ = Speed{0, 0};
+    bool remoteStopButton_ = false;
+    bool remoteStopped_ = false;
+    Press remotePress_ = Press::NO;
+    Intent remoteIntent_ = Intent::STOP;
+    uint32_t remoteWakeTime_ = 0;
+};
+
+// Benchmark
+
+/// The filter the speed profiles replaced - the change per 20 ms tick was limited to a fixed step.
+static int8_t restrictChange(int8_t commandedVal, int8_t val, int8_t maxChange) {
+    const auto delta = commandedVal - val;
+    if (delta >= maxChange) {
+        return val + maxChange;
+    } else if (delta <= -maxChange) {
+        return val - maxChange;
+    } else {
+        return val + delta;
+    }
+}
+
+struct StepResult {
+    uint32_t settleMs;
+    int overshoot;
+    float peakJerk;
+};
+
+/// Measures the speeds the step got answered with on consecutive ticks.
+static StepResult measureStep(const std::vector<int8_t>& speeds, int8_t from, int8_t to, uint32_t period) {
+    const auto dt = period / 1000.0f;
+    auto result = StepResult{UINT32_MAX, 0, 0};
+    const auto direction = to > from ? 1 : -1;
+    for (size_t i = 0; i < speeds.size(); ++i) {
+        if (abs(speeds[i] - to) > 2) {
+            result.settleMs = UINT32_MAX;
+        } else if (result.settleMs == UINT32_MAX) {
+            result.settleMs = uint32_t(i * period);
+        }
+        result.overshoot = std::max(result.overshoot, (speeds[i] - to) * direction);
+        if (i >= 2) {
+            const auto jerk = (speeds[i] - 2 * speeds[i - 1] + speeds[i - 2]) / (dt * dt);
+            result.peakJerk = std::max(result.peakJerk, std::fabs(jerk));
+        }
+    }
+    return result;
+}
+
+static void printStep(const char* name, const char* kind, const StepResult& result) {
+    fprintf(stderr, "%-18s %-8s settle [ms]: %5u  overshoot [%%]: %3d  peak jerk [%%/s^2]: %6.0f\n",
+            name, kind, result.settleMs, result.overshoot, result.peakJerk);
+}
+
+static int benchmark() {
+    struct Step {
+        const char* name;
+        bool steer;
+        int8_t from;
+        int8_t to;
+    };
+    static const Step steps[] = {
+        {"drive 0 -> 100", false, 0, 100},
+        {"drive 100 -> 0", false, 100, 0},
+        {"drive 100 -> -100", false, 100, -100},
+        {"drive 0 -> 40", false, 0, 40},
+        {"steer 0 -> 100", true, 0, 100},
+        {"steer -100 -> 100", true, -100, 100},
+    };
+
+    const auto period = scheduler.basePeriod();
+    const auto dt = period / 1000.0f;
+    const auto ticks = 3000 / period;
+    for (const auto& step : steps) {
+        auto speeds = std::vector<int8_t>{step.from};
+
+        // The filter took steps of 8 when steering and 4 when driving.
+        auto speed = step.from;
+        for (auto i = 0u; i < ticks; ++i) {
+            speed = restrictChange(step.to, speed, step.steer ? 8 : 4);
+            speeds.push_back(speed);
+        }
+        printStep(step.name, "filter", measureStep(speeds, step.from, step.to, period));
+
+        // The same steps as the JerkLimiter takes.
+        const auto& limits = step.steer ? STEER_LIMITS : DRIVE_LIMITS;
+        const auto substeps = (period + PROFILE_STEP - 1) / PROFILE_STEP;
+        auto profile = MotionProfile{};
+        profile.reset(step.from);
+        speeds.assign(1, step.from);
+        for (auto i = 0u; i < ticks; ++i) {
+            for (auto j = 0u; j < substeps; ++j) {
+                profile.update(step.to, limits, dt / substeps);
+            }
+            speeds.push_back(int8_t(lroundf(profile.value())));
+        }
+        printStep(step.name, "profile", measureStep(speeds, step.from, step.to, period));
+    }
+    return 0;
+}
+
+// Replay
+
+static bool loadRecording(const char* path, std::vector<uint8_t>& data) {
+    auto file = fopen(path, "rb");
+    if (file == nullptr) {
+        fprintf(stderr, "cannot open %s\n", path);
+        return false;
+    }
+    char line[256];
+    const auto n = fread(line, 1, 4, file);
+    if (n == 4 && memcmp(line, "EGOR", 4) == 0) {
+        data.assign(line, line + 4);
+        int c;
+        while ((c = fgetc(file)) != EOF) {
+            data.push_back(uint8_t(c));
+        }
+    } else {
+        // Serial capture - pick the hex out of the "@rec" lines and skip the rest of the log.
+        rewind(file);
+        while (fgets(line, sizeof(line), file) != nullptr) {
+            const auto start = strstr(line, "@rec ");
+            if (start == nullptr) {
+                continue;
+            }
+            unsigned byte = 0;
+            for (auto hex = start + 5; sscanf(hex, "%2x", &byte) == 1; hex += 2) {
+                data.push_back(uint8_t(byte));
+            }
+        }
+    }
+    fclose(file);
+    return true;
+}
+
+static void replayRecord(const RecordReader::Record& record, ScriptedPeers& peers) {
+    switch (record.type) {
+        case RecordType::DATAGRAM:
+            if (record.size > 4) {
+                peers.inject(record.payload + 4, record.size - 4);
+            }
+            break;
+        case RecordType::BUTTONS: {
+            Button* buttons[] = {&M5.Btn, &redBtn, &blueBtn};
+            for (auto i = 0; i < 3; ++i) {
+                if (buttons[i]->isPressed() != ((record.payload[0] >> i) & 1)) {
+                    buttons[i]->simulate((record.payload[0] >> i) & 1);
+                }
+            }
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+// Driver
+
+static void printTrace() {
+    printf("time_ms,kind,index,value\n");
+    for (const auto& entry : sim::traceEntries) {
+        switch (entry.kind) {
+            case sim::TraceKind::SERVO:
+                printf("%u,servo,%u,%u\n", entry.time, entry.index, entry.value);
+                break;
+            case sim::TraceKind::LED:
+                printf("%u,led,%u:%u,#%06X\n", entry.time, entry.index >> 8, entry.index & 0xFF, entry.value);
+                break;
+            case sim::TraceKind::INTENT:
+                printf("%u,intent,,%u\n", entry.time, entry.value);
+                break;
+            case sim::TraceKind::RANGE:
+                printf("%u,range,,%u\n", entry.time, entry.value);
+                break;
+        }
+    }
+}
+
+static void printCost(std::vector<uint32_t>& costs) {
+    if (costs.empty()) {
+        return;
+    }
+    auto total = uint64_t{};
+    for (const auto cost : costs) {
+        total += cost;
+    }
+    std::sort(costs.begin(), costs.end());
+    const auto percentile = [&](unsigned p) {
+        return costs[std::min(costs.size() - 1, costs.size() * p / 100)];
+    };
+    fprintf(stderr, "base ticks: %zu (%.1f s virtual time)\n", costs.size(), costs.size() * scheduler.basePeriod() / 1000.0);
+    fprintf(stderr, "tick cost [ns]: mean %llu, min %u, p50 %u, p99 %u, max %u\n",
+            (unsigned long long)(total / costs.size()), costs.front(), percentile(50), percentile(99), costs.back());
+}
+
+static void runTick(std::vector<uint32_t>& costs) {
+    const auto start = std::chrono::steady_clock::now();
+
+    tickMonitor.beginTick();
+    M5.update();
+    scheduler.tick();
+    plankton.flush();
+    tickMonitor.endTick();
+
+    const auto stop = std::chrono::steady_clock::now();
+    costs.push_back(uint32_t(std::chrono::duration_cast<std::chrono::nanoseconds>(stop - start).count()));
+}
+
+/// A recording being replayed tick by tick - the inputs of a tick follow its TICK record.
+class Recording {
+public:
+    bool load(const char* path) {
+        if (!loadRecording(path, data_)) {
+            return false;
+        }
+        reader_ = RecordReader{data_.data(), data_.size()};
+        if (!reader_.isValid()) {
+            fprintf(stderr, "%s is no recording\n", path);
+            return false;
+        }
+        // Whatever precedes the first tick belongs to none.
+        nextTick();
+        return true;
+    }
+
+    uint8_t node() const {
+        return reader_.node();
+    }
+
+    bool hasTick() const {
+        return hasTick_;
+    }
+
+    /// Milliseconds from the first tick of the recording to the next one.
+    uint64_t tickTime() const {
+        return tickTime_;
+    }
+
+    /// Reads the inputs of the next tick - up to the TICK record of the one after.
+    const std::vector<RecordReader::Record>& nextTick() {
+        records_.clear();
+        hasTick_ = false;
+        auto record = RecordReader::Record{};
+        while (reader_.next(record)) {
+            if (record.type == RecordType::TICK && record.size >= 2) {
+                tickTime_ += recordU16(record.payload);
+                hasTick_ = true;
+                break;
+            }
+            records_.push_back(record);
+        }
+        return records_;
+    }
+
+private:
+    std::vector<uint8_t> data_;
+    RecordReader reader_{nullptr, 0};
+    std::vector<RecordReader::Record> records_;
+    bool hasTick_ = false;
+    uint64_t tickTime_ = 0;
+};
+
+/// Runs a tick for each tick of a recording of ego_motion, feeding its inputs just before - or ticks ego_motion
+/// on its own while the recordings of the other nodes get replayed up to the time of each tick.
+static int replay(const std::vector<const char*>& paths, unsigned long maxTicks) {
+    auto recordings = std::vector<Recording>(paths.size());
+    Recording* nodes[3] = {};
+    for (size_t i = 0; i < paths.size(); ++i) {
+        if (!recordings[i].load(paths[i])) {
+            return 1;
+        }
+        const auto node = recordings[i].node();
+        if (node > REMOTE_NODE || nodes[node] != nullptr) {
+            fprintf(stderr, "%s is of an unknown node or of one replayed already\n", paths[i]);
+            return 1;
+        }
+        nodes[node] = &recordings[i];
+    }
+    const auto motion = nodes[MOTION_NODE];
+    if (motion != nullptr && recordings.size() > 1) {
+        fprintf(stderr, "the recording of ego_motion already holds what the other nodes published\n");
+        return 2;
+    }
+
+    setup();
+
+    ScriptedPeers peers;
+    peers.begin();
+
+    auto costs = std::vector<uint32_t>{};
+    sim::traceEntries.reserve(4096);
+
+    if (motion != nullptr) {
+        auto prevTime = uint64_t{};
+        while (motion->hasTick() && (maxTicks == 0 || costs.size() < maxTicks)) {
+            sim::nowMicros += (motion->tickTime() - prevTime) * 1000;
+            prevTime = motion->tickTime();
+            for (const auto& record : motion->nextTick()) {
+                replayRecord(record, peers);
+            }
+            runTick(costs);
+            peers.receive();
+        }
+    } else {
+        const auto ranger = nodes[RANGER_NODE];
+        const auto remote = nodes[REMOTE_NODE];
+        const auto start = millis();
+        auto prevWakeTime = xTaskGetTickCount();
+        while (((ranger != nullptr && ranger->hasTick()) || (remote != nullptr && remote->hasTick())) &&
+               (maxTicks == 0 || costs.size() < maxTicks)) {
+            // The ticks of the others get replayed up to a base period late - stamped with the time of this one.
+            const auto now = millis() - start;
+            while (ranger != nullptr && ranger->hasTick() && ranger->tickTime() <= now) {
+                peers.replayRanger(ranger->nextTick());
+            }
+            while (remote != nullptr && remote->hasTick() && remote->tickTime() <= now) {
+                peers.replayRemote(remote->nextTick());
+            }
+
+            runTick(costs);
+
+            peers.receive();
+
+            vTaskDelayUntil(&prevWakeTime, scheduler.basePeriod());
+        }
+    }
+
+    printCost(costs);
+    peers.printFilterCost();
+    printTrace();
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    const char* scriptPath = nullptr;
+    auto recordingPaths = std::vector<const char*>{};
+    auto maxTicks = 0ul;
+    for (auto i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+            scriptPath = argv[++i];
+        } else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+            recordingPaths.push_back(argv[++i]);
+        } else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            maxTicks = strtoul(argv[++i], nullptr, 10);
+        } else if (strcmp(argv[i], "-b") == 0) {
+            return benchmark();
+        } else if (strcmp(argv[i], "-v") == 0) {
+            sim::serialOut = stderr;
+        } else {
+            fprintf(stderr, "usage: %s [-s script | -r recording ... | -b] [-n ticks] [-v]\n", argv[0]);
+            return 2;
+        }
+    }
+    if (!recordingPaths.empty()) {
+        return replay(recordingPaths, maxTicks);
+    }
+
+    auto events = std::vector<Event>{};
+    auto file = scriptPath != nullptr ? fopen(scriptPath, "r") : nullptr;
+    if (scriptPath != nullptr && file == nullptr) {
+        fprintf(stderr, "cannot open %s\n", scriptPath);
+        return 1;
+    }
+    const auto parsed = parseScript(file, defaultScript, events);
+    if (file != nullptr) {
+        fclose(file);
+    }
+    if (!parsed) {
+        return 1;
+    }
+    if (maxTicks == 0) {
+        maxTicks = ((events.empty() ? 0 : events.back().time) + 5000) / scheduler.basePeriod();
+    }
+
+    setup();
+
+    ScriptedPeers peers;
+    peers.begin();
+
+    auto costs = std::vector<uint32_t>{};
+    costs.reserve(maxTicks);
+    sim::traceEntries.reserve(4096);
+
+    auto next = events.cbegin();
+    auto prevWakeTime = xTaskGetTickCount();
+    for (auto tick = 0ul; tick < maxTicks; ++tick) {
+        for (; next != events.cend() && next->time <= millis(); ++next) {
+            peers.apply(*next);
+        }
+        peers.publish();
+
+        runTick(costs);
+
+        peers.receive();
+
+        vTaskDelayUntil(&prevWakeTime, scheduler.basePeriod());
+    }
+
+    printCost(costs);
+    peers.printFilterCost();
+    printTrace();
+    return 0;
+}
@@ -0,0 +1,65 @@
+// Button stand-in for the host simulation.
+//
+// Copyright (c) 2022, Framework Labs.
+
+#pragma once
+
+#include <Arduino.h>
+
+/// Debounce-free button whose level is set by the simulation driver.
+class Button {
+public:
+    Button(uint8_t pin, uint8_t invert, uint32_t dbTime) : pin_{pin} {
+        (void)invert;
+        (void)dbTime;
+    }
+
+    uint8_t pin() const {
+        return pin_;
+    }
+
+    /// Sets the level which the next `read()` will pick up.
+    void simulate(bool pressed) {
+        level_ = pressed;
+    }
+
+    uint8_t read() {
+        lastState_ = state_;
+        state_ = level_;
+        if (state_ != lastState_) {
+            lastChange_ = millis();
+        }
+        return state_;
+    }
+
+    uint8_t isPressed() const {
+        return state_;
+    }
+
+    uint8_t isReleased() const {
+        return !state_;
+    }
+
+    uint8_t wasPressed() const {
+        return state_ && !lastState_;
+    }
+
+    uint8_t wasReleased() const {
+        return !state_ && lastState_;
+    }
+
+    uint8_t pressedFor(uint32_t ms) const {
+        return state_ && millis() - lastChange_ >= ms;
+    }
+
+    uint8_t releasedFor(uint32_t ms) const {
+        return !state_ && millis() - lastChange_ >= ms;
+    }
+
+private:
+    uint8_t pin_;
+    bool level_ = false;
+    bool state_ = false;
+    bool lastState_ = false;
+    uint32_t lastChange_ = 0;
+};
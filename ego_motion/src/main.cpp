@@ -3,6 +3,8 @@
 // Copyright (c) 2022, Framework Labs.
 
 #include <AtomMotion.h>
+#include <AtomMotionQueue.h>
+#include <ServoTable.h>
 
 #include <ego_common.h>
 
@@ -14,13 +16,12 @@
 
 #include <M5Atom.h>
 #include <FastLED.h>
+#include <Preferences.h>
 
-// Common Types
-
-struct Speed {
-    int8_t x;
-    int8_t y;
-};
+#ifdef EGO_RECORD
+#include <pa_record_sinks.h>
+#include <SPIFFS.h>
+#endif
 
 // Intent
 
@@ -32,7 +33,7 @@ pa_activity (IntentComputer, pa_ctx(), Press press, Press redPress, Press bluePr
         switch (bluePress) {
             case Press::NO: break;
             case Press::SHORT: intent = Intent::START_MANU; break;
-            case Press::LONG: break;
+            case Press::LONG: intent = Intent::CALIBRATE; break;
             case Press::DOUBLE: intent = Intent::START_AUTO; break;
         }
         switch (press) {
@@ -62,10 +63,19 @@ pa_activity (IntentComputer, pa_ctx(), Press press, Press redPress, Press bluePr
     } pa_always_end;
 } pa_end;
 
-pa_activity (PressSubscriber, pa_ctx(), Press& press) {
-    plankton.subscribe(Topic::PRESS, {});
+// The remote holds a press for its publish period of 100 ms, which spans several ticks - only a new sample counts.
+pa_activity (PressSubscriber, pa_ctx(uint32_t count), Press& press) {
+    PressTopic::subscribe(plankton, {MOTION_CHANNEL});
+    pa_self.count = 0;
     pa_always {
-        plankton.read(Topic::PRESS, (uint8_t*)&press, 1);
+        auto received = Press::NO;
+        auto info = Plankton::SampleInfo{};
+        if (PressTopic::read(plankton, received, info) && info.count != pa_self.count) {
+            pa_self.count = info.count;
+            press = received;
+        } else {
+            press = Press::NO;
+        }
     } pa_always_end;
 } pa_end;
 
@@ -89,8 +99,9 @@ pa_activity (IntentRecognizer,
 } pa_end;
 
 pa_activity (IntentPublisher, pa_ctx(Intent prevIntent), Intent intent) {
+    IntentTopic::advertise(plankton, {false, true, 0, true});
     while (true) {
-        plankton.publish(Topic::INTENT, (const uint8_t*)&intent, 1);
+        IntentTopic::publish(plankton, intent);
         pa_self.prevIntent = intent;
         pa_await (intent != pa_self.prevIntent);
     }
@@ -236,24 +247,90 @@ static void stopLights() {
     stopBlinker();
 }
 
+// The lights run in a tree of their own at a lower rate - the controller tells them what to show.
+
+static auto lightsOn = false;
+static auto lightsSpeed = Speed{};
+
+pa_activity (LightsCommander, pa_ctx(), Speed speed) {
+    pa_always {
+        lightsOn = true;
+        lightsSpeed = speed;
+    } pa_always_end;
+} pa_end;
+
+pa_activity (LightsMain, pa_ctx(pa_use(Lights))) {
+    while (true) {
+        pa_await (lightsOn);
+        pa_when_abort (!lightsOn, Lights, lightsSpeed);
+        stopLights();
+    }
+} pa_end;
+
 // Actuator
 
 static auto motion = AtomMotion();
 
-static uint16_t invertPulse(uint16_t pulse) {
-    const auto basePulse = pulse - 1500;
-    return 1500 - basePulse;
+// All I2C transactions with the servo controller run in a task of their own - never in the tick.
+static AtomMotionQueue motionQueue{motion};
+
+// Each servo maps the speed of its wheel to pulses by a table of its own - linear with the TARA trim until
+// the servos got calibrated. The right servo is mounted mirrored, so lower pulses drive it forward.
+static auto leftTable = ServoTable::linear(TARA, 1);
+static auto rightTable = ServoTable::linear(TARA, -1);
+
+// The tables are kept in NVS - as long as this matches.
+static constexpr uint32_t SERVO_TABLES_VERSION = 1;
+
+struct ServoTables {
+    uint32_t version;
+    ServoTable left;
+    ServoTable right;
+};
+
+static void loadServoTables() {
+    auto tables = ServoTables{};
+    auto prefs = Preferences{};
+    prefs.begin("ego_motion", true);
+    const auto size = prefs.getBytes("servos", &tables, sizeof(tables));
+    prefs.end();
+    if (size == sizeof(tables) && tables.version == SERVO_TABLES_VERSION && tables.left.isValid() && tables.right.isValid()) {
+        leftTable = tables.left;
+        rightTable = tables.right;
+    }
+}
+
+static void storeServoTables() {
+    const auto tables = ServoTables{SERVO_TABLES_VERSION, leftTable, rightTable};
+    auto prefs = Preferences{};
+    prefs.begin("ego_motion", false);
+    prefs.putBytes("servos", &tables, sizeof(tables));
+    prefs.end();
 }
 
 pa_activity (PulseCalculator, pa_ctx(), Speed speed, uint16_t& leftPulse, uint16_t& rightPulse) {
-    pa_always { 
-        const uint16_t pulse = 1500 + speed.y * 4; 
-        int16_t potFact = TARA + speed.x * 2;
+    pa_always {
+        // Wheel speeds in 0.1 % - steering is reversed while backing off.
+        auto steer = speed.x * 5;
         if (speed.y < -10) {
-            potFact = -potFact;
+            steer = -steer;
         }
-        leftPulse = pulse + potFact;
-        rightPulse = invertPulse(pulse - potFact);
+        auto left = speed.y * 10 + steer;
+        auto right = speed.y * 10 - steer;
+
+        // Keep the difference when a wheel saturates so that the robot still turns at top speed.
+        const auto over = max(left, right) - 1000;
+        const auto under = min(left, right) + 1000;
+        if (over > 0) {
+            left -= over;
+            right -= over;
+        } else if (under < 0) {
+            left -= under;
+            right -= under;
+        }
+
+        leftPulse = leftTable.pulse(left);
+        rightPulse = rightTable.pulse(right);
     } pa_always_end;
 } pa_end;
 
@@ -261,15 +338,34 @@ static uint16_t guard(uint16_t pulse) {
     return min(uint16_t{2500}, max(uint16_t{500}, pulse));
 }
 
-pa_activity (Servo, pa_ctx(uint16_t leftPulsePrev; uint16_t rightPulsePrev), uint16_t leftPulse, uint16_t rightPulse) {
+// The left servo is on channel 1, the right one on channel 3 - both get written in a single I2C burst.
+static AtomMotionQueue::Ticket setPulses(uint16_t leftPulse, uint16_t rightPulse, bool rewrite = false) {
+    const uint16_t pulses[SERVO_NUM] = {leftPulse, 0, rightPulse, 0};
+    return motionQueue.SubmitServoPulses(SERVO_CH(1) | SERVO_CH(3), pulses, rewrite);
+}
+
+// Unchanged pulses get skipped by the write cache - so rewrite them this often in case the controller lost them.
+static constexpr uint32_t SERVO_REWRITE_PERIOD = 1000;
+
+pa_activity (Servo, pa_ctx(uint16_t leftPulsePrev; uint16_t rightPulsePrev; uint32_t rewriteTime;
+                           AtomMotionQueue::Ticket ticket), 
+                    uint16_t leftPulse, uint16_t rightPulse) {
+    pa_self.rewriteTime = tickTime() + SERVO_REWRITE_PERIOD;
     while (true) {
-        motion.SetServoPulse(1, guard(leftPulse));
-        motion.SetServoPulse(3, guard(rightPulse));
+        if (int32_t(tickTime() - pa_self.rewriteTime) >= 0) {
+            pa_self.ticket = setPulses(guard(leftPulse), guard(rightPulse), true);
+            pa_self.rewriteTime = tickTime() + SERVO_REWRITE_PERIOD;
+        } else {
+            pa_self.ticket = setPulses(guard(leftPulse), guard(rightPulse));
+        }
 
         pa_self.leftPulsePrev = leftPulse;
         pa_self.rightPulsePrev = rightPulse;
 
-        pa_await (leftPulse != pa_self.leftPulsePrev || rightPulse != pa_self.rightPulsePrev);
+        // A failed or rejected write gets retried on the next tick.
+        pa_await (leftPulse != pa_self.leftPulsePrev || rightPulse != pa_self.rightPulsePrev ||
+                  motionQueue.Poll(pa_self.ticket) == AtomMotionQueue::FAILED ||
+                  int32_t(tickTime() - pa_self.rewriteTime) >= 0);
     }
 } pa_end;
 
@@ -280,10 +376,94 @@ pa_activity (Actuator, pa_ctx(pa_co_res(2); pa_use(PulseCalculator); pa_use(Serv
     } pa_co_end;
 } pa_end;
 
-static void stopActuator() {
-    motion.SetServoPulse(1, 1500);
-    motion.SetServoPulse(3, 1500);
-}
+// Ends only once the servos got stopped for sure.
+pa_activity (StopActuator, pa_ctx(AtomMotionQueue::Ticket ticket)) {
+    while (true) {
+        pa_self.ticket = setPulses(SERVO_NEUTRAL, SERVO_NEUTRAL, true);
+        while (motionQueue.Poll(pa_self.ticket) == AtomMotionQueue::PENDING) {
+            pa_pause;
+        }
+        if (motionQueue.Poll(pa_self.ticket) != AtomMotionQueue::FAILED) {
+            break;
+        }
+        pa_pause;
+    }
+} pa_end;
+
+// Braking
+
+// The robot has to be able to stop this long before it would hit an obstacle - which covers braking along
+// the speed profile and the ranges lagging behind.
+static constexpr float MIN_TIME_TO_COLLISION = 1.0f;
+
+// Stops right away if it would hit an obstacle in less than this - ramping down would take too long.
+static constexpr float EMERGENCY_TIME_TO_COLLISION = 0.3f;
+
+// Comes to a stop this far in front of an obstacle.
+static constexpr int STOP_DISTANCE = 60;
+
+// Slower forward speeds barely move the robot, so they rather stop it.
+static constexpr float MIN_FORWARD_SPEED = 10;
+
+// How fast the robot drives at a speed of 100 in mm/s - learned while driving, starting out high to be safe.
+static constexpr float INITIAL_FULL_SPEED = 600;
+static constexpr float MIN_FULL_SPEED = 200;
+static constexpr float MAX_FULL_SPEED = 1000;
+
+// The speed has to be kept this many ticks before the closing velocity tells about it.
+static constexpr unsigned STEADY_TICKS = 25;
+
+struct Braking {
+    int8_t maxForward;  // Caps the forward speed.
+    bool halt;          // Stop right away.
+};
+
+// Allows the forward speed at which the robot would still take `MIN_TIME_TO_COLLISION` to hit the obstacle
+// ahead - so it drives fast while there is room and slows down the closer it gets, independent of the speed
+// it comes with.
+//
+// The closing velocity at a speed is predicted from the full speed, which gets learned from the rate of the
+// ranges while driving straight ahead steadily. If the ranges close in faster than predicted - like when
+// something comes towards the robot - the difference lowers the allowed speed further.
+pa_activity (BrakeGovernor, pa_ctx(float fullSpeed; Speed prevSpeed; unsigned steadyTicks),
+                            uint16_t range, int16_t rate, Speed speed, Braking& braking) {
+    pa_self.fullSpeed = INITIAL_FULL_SPEED;
+    pa_self.prevSpeed = speed;
+    pa_self.steadyTicks = 0;
+    pa_always {
+        if (speed.x != pa_self.prevSpeed.x || speed.y != pa_self.prevSpeed.y) {
+            pa_self.prevSpeed = speed;
+            pa_self.steadyTicks = 0;
+        } else if (pa_self.steadyTicks < STEADY_TICKS) {
+            ++pa_self.steadyTicks;
+        }
+
+        const auto closing = float(-rate);
+        if (range != 0 && pa_self.steadyTicks == STEADY_TICKS && speed.y >= 30 && abs(speed.x) <= 10 && closing > 0) {
+            const auto fullSpeed = min(MAX_FULL_SPEED, max(MIN_FULL_SPEED, closing * 100 / speed.y));
+            pa_self.fullSpeed += (fullSpeed - pa_self.fullSpeed) / 8;
+        }
+
+        const auto room = float(int(range) - STOP_DISTANCE);
+        const auto predicted = max(0, int(speed.y)) * pa_self.fullSpeed / 100;
+        auto allowed = range != 0 && room > 0 ? room / MIN_TIME_TO_COLLISION : 0;
+        if (closing > predicted) {
+            allowed -= closing - predicted;
+        }
+        const auto maxForward = allowed * 100 / pa_self.fullSpeed;
+        braking.maxForward = maxForward < MIN_FORWARD_SPEED ? 0 : int8_t(min(100.0f, maxForward));
+
+        const auto approaching = max(closing, predicted);
+        braking.halt = speed.y > 0 && (room <= 0 || (approaching > 0 && room / approaching < EMERGENCY_TIME_TO_COLLISION));
+    } pa_always_end;
+} pa_end;
+
+// Caps the forward speed to what the brake governor allows.
+pa_activity (SpeedCap, pa_ctx(), Speed speed, int8_t maxForward, Speed& cappedSpeed) {
+    pa_always {
+        cappedSpeed = Speed{speed.x, min(speed.y, maxForward)};
+    } pa_always_end;
+} pa_end;
 
 // Driving
 
@@ -311,120 +491,332 @@ pa_activity (Rotate, pa_ctx(), bool clockwise, Speed& speed) {
     pa_halt;
 } pa_end;
 
-pa_activity (RunAutoCore, pa_ctx(pa_use(DriveForwardAndSetRot); pa_use(Rotate); bool rotClockwise), uint16_t range, Speed& speed) {
+// Turns away once the brake governor slowed the robot down to this - and drives again once it allows more.
+static constexpr int8_t AUTO_TURN_SPEED = 25;
+static constexpr int8_t AUTO_DRIVE_SPEED = 50;
+
+pa_activity (RunAutoCore, pa_ctx(pa_use(DriveForwardAndSetRot); pa_use(Rotate); bool rotClockwise), int8_t maxForward, Speed& speed) {
     setLED(CRGB::Blue);
     while (true) {
-        if (range > 300) {
-            pa_when_abort (range <= 300, DriveForwardAndSetRot, speed, pa_self.rotClockwise);
+        if (maxForward >= AUTO_DRIVE_SPEED) {
+            pa_when_abort (maxForward < AUTO_TURN_SPEED, DriveForwardAndSetRot, speed, pa_self.rotClockwise);
         }
-        pa_when_abort (range > 300, Rotate, pa_self.rotClockwise, speed);
+        pa_when_abort (maxForward >= AUTO_DRIVE_SPEED, Rotate, pa_self.rotClockwise, speed);
     }
 } pa_end;
 
-static int8_t restrictChange(int8_t commandedVal, int8_t val, int8_t maxChange) {
-    const auto delta = commandedVal - val;
-    if (delta >= maxChange) {
-        return val + maxChange;
-    } else if (delta <= -maxChange) {
-        return val - maxChange;
-    } else {
-        return val + delta;
-    }
-}
+// Speeds change with limited acceleration and jerk so that the chassis does not get jerked - steering may
+// change faster than driving. In % per second and per second squared.
+static constexpr ProfileLimits STEER_LIMITS = {600, 6000};
+static constexpr ProfileLimits DRIVE_LIMITS = {300, 3000};
 
-pa_activity (SpeedFilter, pa_ctx(), Speed commandedSpeed, Speed& speed) {
-    pa_always {
-        speed.x = restrictChange(commandedSpeed.x, speed.x, 40);
-        speed.y = restrictChange(commandedSpeed.y, speed.y, 20);
-    } pa_always_end;
+pa_activity (SpeedProfiler, pa_ctx(pa_co_res(2); pa_use_as(JerkLimiter, X); pa_use_as(JerkLimiter, Y)),
+                            Speed commandedSpeed, bool halt, Speed& speed) {
+    pa_co(2) {
+        pa_with_as (JerkLimiter, X, STEER_LIMITS, commandedSpeed.x, halt, speed.x);
+        pa_with_as (JerkLimiter, Y, DRIVE_LIMITS, commandedSpeed.y, halt, speed.y);
+    } pa_co_end;
 } pa_end;
 
-pa_activity (RunAuto, pa_ctx(pa_co_res(2); pa_use(RunAutoCore); pa_use(SpeedFilter); Speed commandedSpeed), uint16_t range, Speed& speed) {
-    pa_co(2) {
-        pa_with (RunAutoCore, range, pa_self.commandedSpeed);
-        pa_with (SpeedFilter, pa_self.commandedSpeed, speed);
+pa_activity (RunAuto, pa_ctx(pa_co_res(3); pa_use(RunAutoCore); pa_use(SpeedCap); pa_use(SpeedProfiler);
+                             Speed commandedSpeed; Speed cappedSpeed), const Braking& braking, Speed& speed) {
+    pa_co(3) {
+        pa_with (RunAutoCore, braking.maxForward, pa_self.commandedSpeed);
+        pa_with (SpeedCap, pa_self.commandedSpeed, braking.maxForward, pa_self.cappedSpeed);
+        pa_with (SpeedProfiler, pa_self.cappedSpeed, braking.halt, speed);
     } pa_co_end;
 } pa_end;
 
-pa_activity (RunManual, pa_ctx(), Speed joySpeed, uint16_t range, Speed& speed) {
+pa_activity (RunManual, pa_ctx(pa_co_res(2); pa_use(SpeedCap); pa_use(SpeedProfiler); Speed cappedSpeed),
+                        Speed joySpeed, const Braking& braking, Speed& speed) {
     setLED(CRGB::Green);
-    pa_always {
-        if (joySpeed.y > 10 && range < 80) {
-            speed = {};
-        } else {
-            speed = joySpeed;
-        }
-    } pa_always_end;
+    pa_co(2) {
+        pa_with (SpeedCap, joySpeed, braking.maxForward, pa_self.cappedSpeed);
+        pa_with (SpeedProfiler, pa_self.cappedSpeed, braking.halt, speed);
+    } pa_co_end;
 } pa_end;
 
-pa_activity (Run, pa_ctx(pa_use(RunAuto); pa_use(RunManual)), Intent intent, Speed joySpeed, uint16_t range, Speed& speed) {
+pa_activity (Run, pa_ctx(pa_use(RunAuto); pa_use(RunManual)), Intent intent, Speed joySpeed, const Braking& braking, Speed& speed) {
     if (intent == Intent::START_MANU) {
-        pa_when_abort (intent != Intent::START_MANU, RunManual, joySpeed, range, speed);
+        pa_when_abort (intent != Intent::START_MANU, RunManual, joySpeed, braking, speed);
     } else {
-        pa_when_abort (intent != Intent::START_AUTO, RunAuto, range, speed);
+        pa_when_abort (intent != Intent::START_AUTO, RunAuto, braking, speed);
+    }
+} pa_end;
+
+// Calibration
+
+// Pulse offsets from the stop pulse of each servo it gets measured at - the first ones fall into the deadband.
+static constexpr uint16_t CAL_OFFSETS[] = {40, 80, 120, 160, 240, 320, 400};
+static constexpr size_t CAL_STEPS = sizeof(CAL_OFFSETS) / sizeof(CAL_OFFSETS[0]);
+
+// Each pulse drives for 1.2 s - the speed is the mean of the last 0.4 s, once the range filter settled.
+static constexpr unsigned CAL_DRIVE_TICKS = 60;
+static constexpr unsigned CAL_MEASURE_TICKS = 20;
+
+// The deadband of a servo gets searched in steps of 10 µs up to 150 µs from the neutral pulse. Driving on its
+// own, the servo turns the robot - so each step only lasts 0.8 s, of which the last 0.3 s get measured.
+static constexpr uint16_t CAL_START_STEP = 10;
+static constexpr uint16_t CAL_MAX_START = 150;
+static constexpr unsigned CAL_START_TICKS = 40;
+static constexpr unsigned CAL_START_MEASURE_TICKS = 15;
+
+// Slower speeds in mm/s count as standing still.
+static constexpr int16_t CAL_MIN_SPEED = 15;
+
+// The wall to range against has to stay at least this far away.
+static constexpr uint16_t CAL_MIN_RANGE = 150;
+
+// Drives for `driveTicks` - `speed` is how fast the range to the wall decreased over the last `measureTicks`.
+pa_activity (MeasureSpeed, pa_ctx(unsigned ticks; int32_t rateSum), uint16_t range, int16_t rate,
+                           unsigned driveTicks, unsigned measureTicks, int16_t& speed, bool& ok) {
+    pa_self.rateSum = 0;
+    for (pa_self.ticks = 0; pa_self.ticks < driveTicks; ++pa_self.ticks) {
+        if (range < CAL_MIN_RANGE) {
+            break;
+        }
+        if (pa_self.ticks >= driveTicks - measureTicks) {
+            pa_self.rateSum += rate;
+        }
+        pa_pause;
+    }
+    ok = pa_self.ticks == driveTicks;
+    speed = int16_t(-pa_self.rateSum / int32_t(measureTicks));
+} pa_end;
+
+// Drives a single servo into a direction with ever larger offsets until it gets going - `start` is that offset.
+// The robot pivots around the other wheel, which moves the sensor at half the speed of the wheel and turns it
+// too, so only the magnitude of the speed tells whether the servo moved.
+pa_activity (FindServoStart, pa_ctx(pa_use(Delay); pa_use(MeasureSpeed); uint16_t offset; int16_t speed),
+                             int8_t mirror, int8_t sign, uint16_t range, int16_t rate, uint16_t& pulse,
+                             uint16_t& start, bool& ok) {
+    // The rate lags behind - give it two seconds to forget what moved before.
+    start = 0;
+    pulse = SERVO_NEUTRAL;
+    pa_run (Delay, 20);
+
+    for (pa_self.offset = CAL_START_STEP; pa_self.offset <= CAL_MAX_START; pa_self.offset += CAL_START_STEP) {
+        pulse = uint16_t(SERVO_NEUTRAL + mirror * sign * pa_self.offset);
+        pa_run (MeasureSpeed, range, rate, CAL_START_TICKS, CAL_START_MEASURE_TICKS, pa_self.speed, ok);
+        if (!ok) {
+            break;
+        }
+        if (2 * abs(pa_self.speed) >= CAL_MIN_SPEED) {
+            start = pa_self.offset;
+            break;
+        }
+    }
+    pulse = SERVO_NEUTRAL;
+    ok = ok && start != 0;
+} pa_end;
+
+// The pulse a servo stands still at - the middle of its deadband with the starts forward and backward.
+// `mirror` is -1 for the right servo, which drives forward with lower pulses.
+static uint16_t stopPulse(int mirror, const uint16_t* starts) {
+    return uint16_t(SERVO_NEUTRAL + mirror * (int(starts[0]) - int(starts[1])) / 2);
+}
+
+// Finds where the deadband of each servo ends in both directions by driving it on its own - forward and then
+// backward, which turns the robot back again - and so the pulse each servo stands still at. Then drives
+// at the wall and back again with both servos at the same offset from their own stop pulse for each pulse -
+// a servo driving on its own at speed would turn the wall out of sight within a fraction of a second.
+// The range only tells the mean speed of both wheels, so both tables get the same speeds, each with the pulses
+// of its own servo around its own stop pulse. A servo which is faster than the other at the same offset does
+// not show - the robot still drifts to one side then.
+pa_activity (CalibrateServos, pa_ctx(pa_use(FindServoStart); pa_use(MeasureSpeed); uint8_t step; int8_t sign;
+                                     int16_t speed; uint16_t starts[2][2]; uint16_t stops[2];
+                                     ServoSample samples[2][2][CAL_STEPS]),
+                              uint16_t range, int16_t rate, uint16_t& leftPulse, uint16_t& rightPulse, bool& ok) {
+    // The left servo drives forward with higher pulses, the right one with lower ones.
+    pa_run (FindServoStart, 1, 1, range, rate, leftPulse, pa_self.starts[0][0], ok);
+    if (ok) {
+        pa_run (FindServoStart, 1, -1, range, rate, leftPulse, pa_self.starts[0][1], ok);
+    }
+    if (ok) {
+        pa_run (FindServoStart, -1, 1, range, rate, rightPulse, pa_self.starts[1][0], ok);
+    }
+    if (ok) {
+        pa_run (FindServoStart, -1, -1, range, rate, rightPulse, pa_self.starts[1][1], ok);
+    }
+    if (ok) {
+        pa_self.stops[0] = stopPulse(1, pa_self.starts[0]);
+        pa_self.stops[1] = stopPulse(-1, pa_self.starts[1]);
+        Serial.printf("calibration stop pulses: left %u us, right %u us - starts forward/backward: %u/%u us, %u/%u us\n",
+                      pa_self.stops[0], pa_self.stops[1],
+                      pa_self.starts[0][0], pa_self.starts[0][1], pa_self.starts[1][0], pa_self.starts[1][1]);
+    }
+
+    for (pa_self.step = 0; ok && pa_self.step < CAL_STEPS; ++pa_self.step) {
+        for (pa_self.sign = 1; pa_self.sign >= -1; pa_self.sign -= 2) {
+            leftPulse = uint16_t(pa_self.stops[0] + pa_self.sign * CAL_OFFSETS[pa_self.step]);
+            rightPulse = uint16_t(pa_self.stops[1] - pa_self.sign * CAL_OFFSETS[pa_self.step]);
+
+            pa_run (MeasureSpeed, range, rate, CAL_DRIVE_TICKS, CAL_MEASURE_TICKS, pa_self.speed, ok);
+            if (!ok) {
+                break;
+            }
+            {
+                const auto direction = pa_self.sign < 0;
+                const auto speed = int16_t(pa_self.sign * pa_self.speed);
+                pa_self.samples[0][direction][pa_self.step] = ServoSample{leftPulse, speed};
+                pa_self.samples[1][direction][pa_self.step] = ServoSample{rightPulse, speed};
+            }
+        }
+    }
+    leftPulse = rightPulse = SERVO_NEUTRAL;
+
+    if (ok) {
+        // Scale to the slower top speed so that backing off is as fast as driving ahead.
+        const auto top = min(topSpeed(pa_self.samples[0][0], CAL_STEPS), topSpeed(pa_self.samples[0][1], CAL_STEPS));
+        Serial.printf("calibration top speed: %d mm/s\n", top);
+
+        auto left = ServoTable{};
+        auto right = ServoTable{};
+        ok = left.fill(true, pa_self.stops[0], pa_self.samples[0][0], CAL_STEPS, top, CAL_MIN_SPEED) &&
+             left.fill(false, pa_self.stops[0], pa_self.samples[0][1], CAL_STEPS, top, CAL_MIN_SPEED) &&
+             right.fill(true, pa_self.stops[1], pa_self.samples[1][0], CAL_STEPS, top, CAL_MIN_SPEED) &&
+             right.fill(false, pa_self.stops[1], pa_self.samples[1][1], CAL_STEPS, top, CAL_MIN_SPEED) &&
+             left.isValid() && right.isValid();
+        if (ok) {
+            leftTable = left;
+            rightTable = right;
+            storeServoTables();
+        }
+    }
+} pa_end;
+
+pa_activity (CalibrationRun, pa_ctx(pa_co_res(2); pa_use(Delay); pa_use(CalibrateServos); pa_use(Servo);
+                                    uint16_t leftPulse; uint16_t rightPulse),
+                             uint16_t range, int16_t rate, bool& ok) {
+    // Give the ranges a second to come in - and whoever pressed the button to step aside.
+    pa_run (Delay, 10);
+
+    pa_self.leftPulse = pa_self.rightPulse = SERVO_NEUTRAL;
+    pa_co(2) {
+        pa_with (CalibrateServos, range, rate, pa_self.leftPulse, pa_self.rightPulse, ok);
+        pa_with_weak (Servo, pa_self.leftPulse, pa_self.rightPulse);
+    } pa_co_end;
+} pa_end;
+
+// Place the robot about 1.5 m in front of a wall, facing it - the ranges tell how fast the servos drive.
+// The LED blinks green once the tables got stored, red if the wall got lost or a servo never got going.
+pa_activity (Calibrate, pa_ctx(pa_use(CalibrationRun); pa_use(StopActuator); pa_use(BlinkLED); bool ok),
+                        Intent intent, uint16_t range, int16_t rate) {
+    setLED(CRGB::Purple);
+    pa_self.ok = false;
+    pa_when_abort (intent != Intent::CALIBRATE, CalibrationRun, range, rate, pa_self.ok);
+    pa_run (StopActuator);
+    if (intent == Intent::CALIBRATE) {
+        pa_when_abort (intent != Intent::CALIBRATE, BlinkLED, pa_self.ok ? CRGB::Green : CRGB::Red, 5, 5);
     }
 } pa_end;
 
+// Scheduling
+
+// Control runs at 50 Hz, the lights at 10 Hz.
+static auto scheduler = RateScheduler{20};
+static auto tickMonitor = TickMonitor{scheduler.basePeriod()};
+
+// The CPU runs at 80 MHz while idle and gets stepped up by the tick load - see setup().
+static auto cpuGovernor = CpuGovernor{scheduler.basePeriod()};
+
+// Joystick and press input ticks right away - but not sooner than this many ms after the previous tick.
+static constexpr TickType_t INPUT_TICK_SPACING = 5;
+
 // Controller
 
-pa_activity (RangeSubscriber, pa_ctx(), uint16_t& range) {
-    plankton.subscribe(Topic::RANGE, {});
+// Ranges captured longer ago than this are not trusted anymore.
+static constexpr uint32_t MAX_RANGE_AGE = 300;
+
+pa_activity (RangeSubscriber, pa_ctx(), uint16_t& range, int16_t& rate) {
+    RangeTopic::subscribe(plankton, {MOTION_CHANNEL});
     pa_always {
-        plankton.read(Topic::RANGE, (uint8_t*)&range, 2);
+        auto ranges = Ranges{};
+        auto info = Plankton::SampleInfo{};
+        if (!RangeTopic::read(plankton, ranges, info) || info.age + ranges.age > MAX_RANGE_AGE) {
+            // Without a fresh range we assume an obstacle right ahead.
+            range = 0;
+            rate = 0;
+        } else {
+            range = frontRange(ranges);
+            rate = frontRate(ranges);
+        }
     } pa_always_end;
 } pa_end;
 
 pa_activity (JoystickSubscriber, pa_ctx(), Speed& speed) {
-    plankton.subscribe(Topic::JOYSTICK, {});
+    JoystickTopic::subscribe(plankton, {MOTION_CHANNEL});
     pa_always {
-        uint8_t buf[3];
-        plankton.read(Topic::JOYSTICK, buf, 3);
-        speed.x = buf[0];
-        speed.y = buf[1];
+        auto info = Plankton::SampleInfo{};
+        if (!JoystickTopic::read(plankton, speed, info) || info.age > MAX_JOYSTICK_AGE) {
+            // Without word from the remote for a while we stop rather than keep driving blind.
+            speed = Speed{0, 0};
+        }
     } pa_always_end;
 } pa_end;
 
-pa_activity (Logger, pa_ctx(), Speed speed, uint16_t range) {
-    pa_always {
+// Logs every `period` ticks - each line costs the 50 Hz control loop time on the serial port.
+pa_activity (Logger, pa_ctx(unsigned ticks), Speed speed, uint16_t range, unsigned period) {
+    while (true) {
         Serial.printf("speed x: %d, y: %d\n", speed.x, speed.y);
         Serial.printf("range: %u\n", range);
-    } pa_always_end;
+        pa_self.ticks = period;
+        while (pa_self.ticks > 0) {
+            pa_pause;
+            pa_self.ticks -= 1;
+        }
+    }
 } pa_end;
 
-pa_activity (Controller, pa_ctx(pa_co_res(6); uint16_t range; Speed speed;
-                             Speed joySpeed; pa_use(JoystickSubscriber);
+pa_activity (Controller, pa_ctx(pa_co_res(7); uint16_t range; int16_t rate; Braking braking; Speed speed;
+                             Speed joySpeed; pa_use(JoystickSubscriber); pa_use(BrakeGovernor);
                              pa_use(Run); pa_use(BlinkLED); pa_use(Logger);
-                             pa_use(RangeSubscriber); pa_use(Actuator); pa_use(Lights)), 
+                             pa_use(RangeSubscriber); pa_use(Actuator); pa_use(StopActuator);
+                             pa_use(LightsCommander); pa_use(Calibrate)), 
                       Intent intent) {
     setLED(CRGB::Red);
 
     while (true) {
-        pa_await (intent == Intent::START_AUTO || intent == Intent::START_MANU || intent == Intent::QUIT);
+        pa_await (intent == Intent::START_AUTO || intent == Intent::START_MANU || intent == Intent::QUIT ||
+                  intent == Intent::CALIBRATE);
 
         if (intent == Intent::QUIT) {
             break;
         }
-        pa_co(6) {
+        if (intent == Intent::CALIBRATE) {
+            pa_co(2) {
+                pa_with_weak (RangeSubscriber, pa_self.range, pa_self.rate);
+                pa_with (Calibrate, intent, pa_self.range, pa_self.rate);
+            } pa_co_end;
+            setLED(CRGB::Red);
+            continue;
+        }
+        // Driving autonomously reacts to ranges - don't wait for the load to boost the CPU.
+        cpuGovernor.setFloor(intent == Intent::START_AUTO ? CpuLevel::MHZ_160 : CpuLevel::MHZ_80);
+        pa_co(7) {
             pa_with_weak (JoystickSubscriber, pa_self.joySpeed);
-            pa_with_weak (RangeSubscriber, pa_self.range);
-            pa_with (Run, intent, pa_self.joySpeed, pa_self.range, pa_self.speed);
+            pa_with_weak (RangeSubscriber, pa_self.range, pa_self.rate);
+            pa_with_weak (BrakeGovernor, pa_self.range, pa_self.rate, pa_self.speed, pa_self.braking);
+            pa_with (Run, intent, pa_self.joySpeed, pa_self.braking, pa_self.speed);
             pa_with_weak (Actuator, pa_self.speed);
-            pa_with_weak (Lights, pa_self.speed);
-            pa_with_weak (Logger, pa_self.speed, pa_self.range);
+            pa_with_weak (LightsCommander, pa_self.speed);
+            pa_with_weak (Logger, pa_self.speed, pa_self.range, 5);
         } pa_co_end;
 
+        cpuGovernor.setFloor(CpuLevel::MHZ_80);
         pa_self.speed = {};
-        stopActuator();
-        stopLights();
+        pa_run (StopActuator);
+        lightsOn = false;
         setLED(CRGB::Red);
     }
 } pa_end;
 
 // Main
 
-pa_activity (Main, pa_ctx(pa_co_res(4); Intent intent; pa_use(IntentPublisher);
+pa_activity (Main, pa_ctx(pa_co_res(7); Intent intent; pa_use(IntentPublisher);
                           pa_use(IntentRecognizer); pa_use(BlinkLED); pa_use(Receiver);                          
-                          pa_use(Controller); pa_use(Connector))) {
+                          pa_use(Controller); pa_use(Connector); pa_use_as(TopicPublisher, Stats);
+                          pa_use_as(TopicPublisher, Ticks); pa_use(TickLogger))) {
     Serial.println("Start");
     pa_co(2) {
         pa_with (Connector);
@@ -432,10 +824,13 @@ pa_activity (Main, pa_ctx(pa_co_res(4); Intent intent; pa_use(IntentPublisher);
     } pa_co_end;
     clearLED();
 
-    pa_co(4) {
+    pa_co(7) {
         pa_with_weak (Receiver);
         pa_with_weak (IntentRecognizer, pa_self.intent);
         pa_with_weak (IntentPublisher, pa_self.intent);
+        pa_with_weak_as (TopicPublisher, Stats, MotionDiagnosticsTopic{}, plankton.stats(), 250);
+        pa_with_weak_as (TopicPublisher, Ticks, MotionTicksTopic{}, tickMonitor.stats(), 250);
+        pa_with_weak (TickLogger, tickMonitor, 500);
         pa_with (Controller, pa_self.intent);
     } pa_co_end;
     
@@ -446,27 +841,71 @@ pa_activity (Main, pa_ctx(pa_co_res(4); Intent intent; pa_use(IntentPublisher);
 // Setup and Loop
 
 static pa_use(Main);
+static pa_use(LightsMain);
 
 void setup() {
-    setCpuFrequencyMhz(80);
+    setCpuFrequencyMhz(cpuGovernor.frequencyMhz());
+    tickMonitor.setGovernor(&cpuGovernor);
 
     M5.begin();
 
+    loadServoTables();
+
     motion.Init();
+    motionQueue.Begin();
+
+    plankton.setBatching(true);
+
+    // React to joystick and press input right away instead of at the next regular tick.
+    startInputWakeup({Topic::JOYSTICK, Topic::PRESS}, INPUT_TICK_SPACING);
 
     initLights();
     initLED();
+
+    scheduler.add([] { pa_tick(Main); }, 1);
+    scheduler.add([] { pa_tick(LightsMain); }, 5, 1);
+
+#ifdef EGO_RECORD
+    // Record the inputs of every tick to replay them in the host simulation - on SPIFFS if
+    // EGO_RECORD is 2, on Serial otherwise.
+#if EGO_RECORD == 2
+    SPIFFS.begin(true);
+    static auto recordSink = FileRecordSink{SPIFFS.open("/inputs.rec", FILE_WRITE)};
+#else
+    static auto recordSink = SerialRecordSink{};
+#endif
+    inputRecorder.begin(recordSink, MOTION_NODE);
+#endif
 }
 
+#ifdef EGO_RECORD
+static uint8_t buttonMask() {
+    return uint8_t(M5.Btn.isPressed() | redBtn.isPressed() << 1 | blueBtn.isPressed() << 2);
+}
+#endif
+
 void loop() {
     TickType_t prevWakeTime = xTaskGetTickCount();
+    auto elapsed = TickType_t{scheduler.basePeriod()};
 
     while (true) {
+        tickMonitor.beginTick();
+#ifdef EGO_RECORD
+        inputRecorder.beginTick(millis());
+#endif
+
         M5.update();
 
-        pa_tick(Main);
+        scheduler.tickAfter(elapsed);
+
+        plankton.flush();
+
+#ifdef EGO_RECORD
+        inputRecorder.recordButtons(buttonMask());
+        inputRecorder.endTick();
+#endif
+        tickMonitor.endTick();
 
-        // We run at 10 Hz.
-        vTaskDelayUntil(&prevWakeTime, 100);
+        elapsed = waitForNextTick(prevWakeTime, scheduler.basePeriod());
     }
 }
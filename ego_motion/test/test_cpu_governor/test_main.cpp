@@ -0,0 +1,119 @@
+// Tests of the CPU governor on a fake clock
+//
+// Copyright (c) 2022, Framework Labs.
+//
+// Run with: pio test -e native
+
+#include <pa_utils.h>
+
+#include <unity.h>
+
+#include <Arduino.h>
+
+// The stand-ins of the host simulation for the Arduino functions pa_utils calls.
+HardwareSerial Serial;
+
+namespace sim {
+uint64_t nowMicros = 0;
+FILE* serialOut = nullptr;
+}
+
+// Ticks of 20 ms like the control loop of ego_motion.
+static constexpr uint32_t PERIOD = 20;
+
+/// Feeds the governor ticks of `work` microseconds at 80 MHz - faster at higher frequencies.
+struct FakeLoop {
+    CpuGovernor governor{PERIOD};
+    uint32_t nowMs = 0;
+
+    /// Runs `ticks` ticks and returns how many changed the level.
+    unsigned run(unsigned ticks, uint32_t work) {
+        auto changes = 0u;
+        for (auto i = 0u; i < ticks; ++i) {
+            nowMs += PERIOD;
+            changes += governor.update(nowMs, work * 80 / governor.frequencyMhz());
+        }
+        return changes;
+    }
+
+    /// Runs ticks until the governor reaches `level` - returns the number of ticks or 0 if it did not within `limit`.
+    unsigned runUntil(CpuLevel level, uint32_t work, unsigned limit) {
+        for (auto ticks = 1u; ticks <= limit; ++ticks) {
+            run(1, work);
+            if (governor.level() == level) {
+                return ticks;
+            }
+        }
+        return 0;
+    }
+};
+
+void setUp() {}
+
+void tearDown() {}
+
+static void test_stays_low_while_idle() {
+    FakeLoop loop;
+    TEST_ASSERT_EQUAL_UINT(0, loop.run(500, 2000));
+    TEST_ASSERT_TRUE(loop.governor.level() == CpuLevel::MHZ_80);
+    TEST_ASSERT_EQUAL_UINT32(500 * PERIOD - PERIOD, loop.governor.timeInLevel(CpuLevel::MHZ_80));
+}
+
+static void test_single_long_tick_does_not_step_up() {
+    FakeLoop loop;
+    loop.run(50, 2000);
+    TEST_ASSERT_EQUAL_UINT(0, loop.run(1, 40000));
+    TEST_ASSERT_TRUE(loop.governor.level() == CpuLevel::MHZ_80);
+}
+
+static void test_steps_up_under_load() {
+    // 30 ms of work at 80 MHz overrun a 20 ms tick and are still 75 % at 160 MHz - 10 ms at 240 MHz fit.
+    // Both steps take a few ticks of smoothing, but well below a second.
+    FakeLoop loop;
+    const auto ticks = loop.runUntil(CpuLevel::MHZ_240, 30000, 100);
+    TEST_ASSERT_GREATER_THAN_UINT32(0, ticks);
+    TEST_ASSERT_LESS_OR_EQUAL_UINT32(1000 / PERIOD, ticks);
+    TEST_ASSERT_EQUAL_UINT(0, loop.run(500, 30000));
+}
+
+static void test_hysteresis_holds_level() {
+    // 20 ms at 80 MHz are 33 % at 240 MHz, below the 40 % to step down, but would be 50 % at 160 MHz.
+    FakeLoop loop;
+    loop.runUntil(CpuLevel::MHZ_240, 30000, 100);
+    TEST_ASSERT_EQUAL_UINT(0, loop.run(1000, 20000));
+    TEST_ASSERT_TRUE(loop.governor.level() == CpuLevel::MHZ_240);
+}
+
+static void test_steps_down_after_hold() {
+    FakeLoop loop;
+    loop.runUntil(CpuLevel::MHZ_240, 30000, 100);
+
+    // The load has to stay low for the hold time of 2 s before each step down.
+    const auto holdTicks = 2000 / PERIOD;
+    TEST_ASSERT_EQUAL_UINT(0, loop.run(holdTicks - 1, 2000));
+    TEST_ASSERT_TRUE(loop.governor.level() == CpuLevel::MHZ_240);
+
+    const auto ticks = loop.runUntil(CpuLevel::MHZ_80, 2000, 4 * holdTicks);
+    TEST_ASSERT_GREATER_THAN_UINT32(holdTicks, ticks);
+}
+
+static void test_floor_keeps_level_up() {
+    FakeLoop loop;
+    loop.governor.setFloor(CpuLevel::MHZ_160);
+    TEST_ASSERT_EQUAL_UINT(1, loop.run(500, 0));
+    TEST_ASSERT_TRUE(loop.governor.level() == CpuLevel::MHZ_160);
+
+    loop.governor.setFloor(CpuLevel::MHZ_80);
+    TEST_ASSERT_GREATER_THAN_UINT32(0, loop.runUntil(CpuLevel::MHZ_80, 0, 200));
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_stays_low_while_idle);
+    RUN_TEST(test_single_long_tick_does_not_step_up);
+    RUN_TEST(test_steps_up_under_load);
+    RUN_TEST(test_hysteresis_holds_level);
+    RUN_TEST(test_steps_down_after_hold);
+    RUN_TEST(test_floor_keeps_level_up);
+    return UNITY_END();
+}
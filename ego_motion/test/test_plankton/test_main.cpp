@@ -0,0 +1,454 @@
+// Tests of Plankton over the loopback transport
+//
+// Copyright (c) 2022, Framework Labs.
+//
+// Run with: pio test -e native
+
+// Room for a flood of datagrams to pile up.
+#define PLANKTON_LOOPBACK_DEPTH 64
+
+#include <plankton.h>
+#include <plankton_loopback.h>
+#include <plankton_typed.h>
+
+#include <unity.h>
+
+#include <algorithm>
+#include <cstring>
+#include <initializer_list>
+
+// The clock of Plankton is the virtual one of the host simulation.
+namespace sim {
+uint64_t nowMicros = 0;
+}
+
+static constexpr uint32_t RANGE = 52;
+static constexpr uint32_t JOYSTICK = 53;
+static constexpr uint32_t INTENT = 54;
+static constexpr uint32_t PRESS = 55;
+static constexpr uint32_t FOREIGN = 999;
+static constexpr uint8_t CHANNEL = 1;
+
+/// A Plankton instance on the bus of the test.
+struct Node {
+    explicit Node(LoopbackBus& bus) : transport{bus}, plankton{transport} {}
+
+    /// Tells whether a datagram is pending without handing it to Plankton.
+    bool hasDatagram() {
+        uint8_t data[PLANKTON_MAX_DATAGRAM];
+        auto size = size_t{};
+        auto from = uint32_t{};
+        return transport.receive(data, sizeof(data), size, from);
+    }
+
+    LoopbackTransport transport;
+    Plankton plankton;
+};
+
+void setUp() {}
+
+void tearDown() {}
+
+// Multicast
+
+static void test_multicast_reaches_only_subscribers() {
+    LoopbackBus bus;
+    Node publisher{bus};
+    Node subscriber{bus};
+    Node bystander{bus};
+    Node idle{bus};
+
+    subscriber.plankton.subscribe(RANGE, {CHANNEL});
+    subscriber.plankton.subscribe(JOYSTICK, {0});
+    bystander.plankton.subscribe(INTENT, {0});
+    for (auto node : {&publisher, &subscriber, &bystander, &idle}) {
+        node->plankton.begin();
+    }
+    publisher.plankton.advertise(RANGE, {true, true, CHANNEL, false});
+    publisher.plankton.advertise(JOYSTICK, {false, true, 0, false});
+
+    const uint8_t range[] = {1, 2, 3, 4};
+    const uint8_t joystick[] = {5, 6};
+    TEST_ASSERT_TRUE(publisher.plankton.publish(RANGE, range, sizeof(range)));
+    TEST_ASSERT_TRUE(publisher.plankton.publish(JOYSTICK, joystick, sizeof(joystick)));
+
+    // Not even a datagram to drop arrives at the other nodes.
+    TEST_ASSERT_FALSE(publisher.hasDatagram());
+    TEST_ASSERT_FALSE(bystander.hasDatagram());
+    TEST_ASSERT_FALSE(idle.hasDatagram());
+
+    TEST_ASSERT_TRUE(subscriber.plankton.poll());
+    uint8_t data[4] = {};
+    TEST_ASSERT_TRUE(subscriber.plankton.read(RANGE, data, sizeof(range)));
+    TEST_ASSERT_EQUAL_MEMORY(range, data, sizeof(range));
+    TEST_ASSERT_TRUE(subscriber.plankton.read(JOYSTICK, data, sizeof(joystick)));
+    TEST_ASSERT_EQUAL_MEMORY(joystick, data, sizeof(joystick));
+    TEST_ASSERT_EQUAL_UINT32(2, subscriber.plankton.stats().rxDatagrams);
+}
+
+static void test_broadcast_reaches_all() {
+    LoopbackBus bus;
+    Node publisher{bus};
+    Node subscriber{bus};
+    Node idle{bus};
+    subscriber.plankton.subscribe(INTENT, {0});
+    for (auto node : {&publisher, &subscriber, &idle}) {
+        node->plankton.begin();
+    }
+
+    // Unadvertised topics are broadcast - the other nodes have to drop them.
+    const uint8_t intent[] = {1};
+    TEST_ASSERT_TRUE(publisher.plankton.publish(INTENT, intent, sizeof(intent)));
+    TEST_ASSERT_TRUE(subscriber.plankton.poll());
+    TEST_ASSERT_FALSE(idle.plankton.poll());
+    TEST_ASSERT_EQUAL_UINT32(1, idle.plankton.stats().rxUnknown);
+}
+
+// Flood Protection
+
+/// Delivers a foreign datagram whenever asked - each one takes `micros` of the virtual time to receive.
+class FloodTransport : public PlanktonTransport {
+public:
+    explicit FloodTransport(uint32_t micros) : micros_{micros} {}
+
+    bool begin(uint16_t /*port*/) override {
+        return true;
+    }
+
+    bool isConnected() override {
+        return true;
+    }
+
+    bool send(uint32_t /*addr*/, const uint8_t* /*data*/, size_t /*size*/) override {
+        return true;
+    }
+
+    bool joinGroup(uint32_t /*group*/) override {
+        return true;
+    }
+
+    bool receive(uint8_t* data, size_t capacity, size_t& size, uint32_t& from) override {
+        sim::nowMicros += micros_;
+        const uint8_t packet[8] = {FOREIGN & 0xFF, FOREIGN >> 8};
+        size = sizeof(packet);
+        from = 0;
+        memcpy(data, packet, std::min(size, capacity));
+        return true;
+    }
+
+private:
+    uint32_t micros_;
+};
+
+static void test_budget_bounds_datagrams() {
+    LoopbackBus bus;
+    Node flooder{bus};
+    Node subscriber{bus};
+    subscriber.plankton.subscribe(RANGE, {0});
+    flooder.plankton.begin();
+    subscriber.plankton.begin();
+
+    // A flood of foreign datagrams with a range at its end.
+    const uint8_t payload[] = {1, 2, 3, 4};
+    for (auto i = 0; i < 40; ++i) {
+        flooder.plankton.publish(FOREIGN, payload, sizeof(payload));
+    }
+    flooder.plankton.publish(RANGE, payload, sizeof(payload));
+
+    const auto budget = Plankton::PollBudget{16, 0};
+    auto morePending = false;
+    for (auto i = 1; i <= 2; ++i) {
+        TEST_ASSERT_FALSE(subscriber.plankton.poll(budget, morePending));
+        TEST_ASSERT_TRUE(morePending);
+        TEST_ASSERT_EQUAL_UINT32(16 * i, subscriber.plankton.stats().rxDatagrams);
+    }
+    TEST_ASSERT_TRUE(subscriber.plankton.poll(budget, morePending));
+    TEST_ASSERT_FALSE(morePending);
+
+    // Foreign packets get dropped right after their topic - they do not show up in the stats of any topic.
+    const auto stats = subscriber.plankton.stats();
+    TEST_ASSERT_EQUAL_UINT32(41, stats.rxDatagrams);
+    TEST_ASSERT_EQUAL_UINT32(40, stats.rxUnknown);
+    auto topicStats = Plankton::TopicStats{};
+    TEST_ASSERT_TRUE(subscriber.plankton.topicStats(RANGE, topicStats));
+    TEST_ASSERT_EQUAL_UINT32(1, topicStats.rxPackets);
+}
+
+static void test_budget_bounds_time() {
+    FloodTransport transport{400};
+    Plankton plankton{transport};
+    plankton.subscribe(RANGE, {0});
+    plankton.begin();
+
+    // The flood never ends, yet each poll returns once its time is up - on the datagram which used it up.
+    const auto budget = Plankton::PollBudget{0, 5000};
+    auto morePending = false;
+    for (auto i = 1; i <= 3; ++i) {
+        const auto start = sim::nowMicros;
+        TEST_ASSERT_FALSE(plankton.poll(budget, morePending));
+        TEST_ASSERT_TRUE(morePending);
+        TEST_ASSERT_LESS_OR_EQUAL_UINT32(5000 + 400, uint32_t(sim::nowMicros - start));
+        TEST_ASSERT_EQUAL_UINT32(13 * i, plankton.stats().rxUnknown);
+    }
+}
+
+// Reliability
+
+/// Passes datagrams on to a loopback transport - except for those it is told to drop or hold back.
+class FaultyTransport : public PlanktonTransport {
+public:
+    explicit FaultyTransport(LoopbackBus& bus) : transport_{bus} {}
+
+    bool begin(uint16_t port) override {
+        return transport_.begin(port);
+    }
+
+    bool isConnected() override {
+        return transport_.isConnected();
+    }
+
+    bool send(uint32_t addr, const uint8_t* data, size_t size) override {
+        if (drops_ > 0) {
+            --drops_;
+            return true;
+        }
+        if (holding_ && heldSize_ == 0) {
+            heldAddr_ = addr;
+            heldSize_ = std::min(size, sizeof(held_));
+            memcpy(held_, data, heldSize_);
+            return true;
+        }
+        return transport_.send(addr, data, size);
+    }
+
+    bool joinGroup(uint32_t group) override {
+        return transport_.joinGroup(group);
+    }
+
+    bool receive(uint8_t* data, size_t capacity, size_t& size, uint32_t& from) override {
+        return transport_.receive(data, capacity, size, from);
+    }
+
+    /// Silently drops the next `count` datagrams sent.
+    void drop(unsigned count) {
+        drops_ = count;
+    }
+
+    /// Holds back the next datagram sent until `release` is called.
+    void hold() {
+        holding_ = true;
+        heldSize_ = 0;
+    }
+
+    void release() {
+        holding_ = false;
+        transport_.send(heldAddr_, held_, heldSize_);
+    }
+
+private:
+    LoopbackTransport transport_;
+    unsigned drops_ = 0;
+    bool holding_ = false;
+    uint32_t heldAddr_ = 0;
+    size_t heldSize_ = 0;
+    uint8_t held_[PLANKTON_MAX_DATAGRAM];
+};
+
+static void advanceMillis(uint32_t ms) {
+    sim::nowMicros += uint64_t{ms} * 1000;
+}
+
+static void test_lost_reliable_packet_resent_until_acked() {
+    LoopbackBus bus;
+    FaultyTransport transport{bus};
+    Plankton publisher{transport};
+    Node subscriber{bus};
+    subscriber.plankton.subscribe(PRESS, {CHANNEL});
+    publisher.begin();
+    subscriber.plankton.begin();
+    publisher.advertise(PRESS, {false, true, CHANNEL, true});
+
+    // The publish and the first resend get lost.
+    transport.drop(2);
+    const uint8_t press[] = {2};
+    TEST_ASSERT_TRUE(publisher.publish(PRESS, press, sizeof(press)));
+    TEST_ASSERT_FALSE(subscriber.plankton.poll());
+
+    advanceMillis(PLANKTON_RESEND_TIMEOUT);
+    publisher.poll();
+    TEST_ASSERT_FALSE(subscriber.plankton.poll());
+
+    // The timeout doubles with each resend.
+    advanceMillis(PLANKTON_RESEND_TIMEOUT);
+    publisher.poll();
+    TEST_ASSERT_FALSE(subscriber.hasDatagram());
+    advanceMillis(PLANKTON_RESEND_TIMEOUT);
+    publisher.poll();
+    TEST_ASSERT_TRUE(subscriber.plankton.poll());
+    uint8_t data[1] = {};
+    TEST_ASSERT_TRUE(subscriber.plankton.read(PRESS, data, sizeof(data)));
+    TEST_ASSERT_EQUAL_UINT8(press[0], data[0]);
+
+    // Once the ack got received, nothing gets resent anymore.
+    publisher.poll();
+    advanceMillis(PLANKTON_RESEND_TIMEOUT << PLANKTON_MAX_RESENDS);
+    publisher.poll();
+    TEST_ASSERT_FALSE(subscriber.hasDatagram());
+    auto stats = Plankton::TopicStats{};
+    TEST_ASSERT_TRUE(publisher.topicStats(PRESS, stats));
+    TEST_ASSERT_EQUAL_UINT32(1, stats.txPackets);
+    TEST_ASSERT_EQUAL_UINT32(2, stats.resends);
+}
+
+static void test_reordering_within_window_counted() {
+    LoopbackBus bus;
+    FaultyTransport transport{bus};
+    Plankton publisher{transport};
+    Node subscriber{bus};
+    subscriber.plankton.subscribe(RANGE, {CHANNEL});
+    publisher.begin();
+    subscriber.plankton.begin();
+    publisher.advertise(RANGE, {true, true, CHANNEL, false});
+
+    // The second packet arrives after the third - too late to still be taken.
+    uint8_t range[] = {0};
+    publisher.publish(RANGE, range, sizeof(range));
+    transport.hold();
+    range[0] = 1;
+    publisher.publish(RANGE, range, sizeof(range));
+    range[0] = 2;
+    publisher.publish(RANGE, range, sizeof(range));
+    transport.release();
+
+    TEST_ASSERT_TRUE(subscriber.plankton.poll());
+    uint8_t data[1] = {};
+    auto info = Plankton::SampleInfo{};
+    TEST_ASSERT_TRUE(subscriber.plankton.read(RANGE, data, sizeof(data), info));
+    TEST_ASSERT_EQUAL_UINT8(2, data[0]);
+    TEST_ASSERT_TRUE(info.stamped);
+    TEST_ASSERT_EQUAL_UINT16(2, info.seq);
+    TEST_ASSERT_EQUAL_UINT32(2, info.count);
+    TEST_ASSERT_EQUAL_UINT32(1, info.reordered);
+    TEST_ASSERT_EQUAL_UINT32(0, info.duplicates);
+
+    // A jump back beyond the window is taken as a restart of the publisher instead.
+    transport.hold();
+    publisher.publish(RANGE, range, sizeof(range));
+    for (auto i = 0; i < 40; ++i) {
+        publisher.publish(RANGE, range, sizeof(range));
+        subscriber.plankton.poll();
+    }
+    transport.release();
+    TEST_ASSERT_TRUE(subscriber.plankton.poll());
+    TEST_ASSERT_TRUE(subscriber.plankton.describe(RANGE, info));
+    TEST_ASSERT_EQUAL_UINT16(3, info.seq);
+    TEST_ASSERT_EQUAL_UINT32(1, info.reordered);
+}
+
+// Batching
+
+static void test_batch_split_into_packets() {
+    LoopbackBus bus;
+    Node publisher{bus};
+    Node subscriber{bus};
+    LoopbackTransport sniffer{bus};
+    subscriber.plankton.subscribe(RANGE, {CHANNEL});
+    subscriber.plankton.subscribe(JOYSTICK, {CHANNEL});
+    publisher.plankton.begin();
+    subscriber.plankton.begin();
+    sniffer.begin(planktonPort);
+    sniffer.joinGroup(planktonChannelGroup(CHANNEL));
+    publisher.plankton.advertise(RANGE, {true, true, CHANNEL, false});
+    publisher.plankton.advertise(JOYSTICK, {false, true, CHANNEL, false});
+    publisher.plankton.setBatching(true);
+
+    const uint8_t range[] = {1, 2, 3, 4};
+    const uint8_t joystick[] = {5, 6};
+    TEST_ASSERT_TRUE(publisher.plankton.publish(RANGE, range, sizeof(range)));
+    TEST_ASSERT_TRUE(publisher.plankton.publish(JOYSTICK, joystick, sizeof(joystick)));
+    TEST_ASSERT_FALSE(subscriber.hasDatagram());
+    TEST_ASSERT_TRUE(publisher.plankton.flush());
+
+    // A single datagram starting with the marker and then each packet prefixed by its size.
+    uint8_t datagram[PLANKTON_MAX_DATAGRAM];
+    auto size = size_t{};
+    auto from = uint32_t{};
+    TEST_ASSERT_TRUE(sniffer.receive(datagram, sizeof(datagram), size, from));
+    TEST_ASSERT_FALSE(sniffer.receive(datagram, sizeof(datagram), size, from));
+    auto marker = uint32_t{};
+    memcpy(&marker, datagram, sizeof(marker));
+    TEST_ASSERT_EQUAL_HEX32(0x7FFFFFFF, marker);
+    TEST_ASSERT_EQUAL_UINT8(10 + sizeof(range), datagram[4]);
+    TEST_ASSERT_EQUAL_UINT8(4 + sizeof(joystick), datagram[4 + 1 + 10 + sizeof(range)]);
+    TEST_ASSERT_EQUAL_size_t(4 + 1 + 10 + sizeof(range) + 1 + 4 + sizeof(joystick), size);
+
+    TEST_ASSERT_TRUE(subscriber.plankton.poll());
+    uint8_t data[4] = {};
+    TEST_ASSERT_TRUE(subscriber.plankton.read(RANGE, data, sizeof(range)));
+    TEST_ASSERT_EQUAL_MEMORY(range, data, sizeof(range));
+    TEST_ASSERT_TRUE(subscriber.plankton.read(JOYSTICK, data, sizeof(joystick)));
+    TEST_ASSERT_EQUAL_MEMORY(joystick, data, sizeof(joystick));
+    const auto stats = subscriber.plankton.stats();
+    TEST_ASSERT_EQUAL_UINT32(1, stats.rxDatagrams);
+    TEST_ASSERT_EQUAL_UINT32(0, stats.rxRunts);
+
+    // A lone packet goes out without the framing.
+    TEST_ASSERT_TRUE(publisher.plankton.publish(JOYSTICK, joystick, sizeof(joystick)));
+    TEST_ASSERT_TRUE(publisher.plankton.flush());
+    TEST_ASSERT_TRUE(sniffer.receive(datagram, sizeof(datagram), size, from));
+    TEST_ASSERT_EQUAL_size_t(4 + sizeof(joystick), size);
+    memcpy(&marker, datagram, sizeof(marker));
+    TEST_ASSERT_EQUAL_HEX32(JOYSTICK, marker);
+}
+
+// Typed Topics
+
+struct Position {
+    int16_t x;
+    int16_t y;
+};
+
+using PositionTopic = TypedTopic<RANGE, Position>;
+
+static void test_typed_topic_checks_size() {
+    LoopbackBus bus;
+    Node publisher{bus};
+    Node subscriber{bus};
+    PositionTopic::subscribe(subscriber.plankton, {CHANNEL});
+    publisher.plankton.begin();
+    subscriber.plankton.begin();
+    TEST_ASSERT_TRUE(PositionTopic::advertise(publisher.plankton, {true, true, CHANNEL, false}));
+
+    auto position = Position{-7, 7};
+    TEST_ASSERT_FALSE(PositionTopic::read(subscriber.plankton, position));
+
+    TEST_ASSERT_TRUE(PositionTopic::publish(publisher.plankton, Position{3, -4}));
+    TEST_ASSERT_TRUE(subscriber.plankton.poll());
+    auto info = Plankton::SampleInfo{};
+    TEST_ASSERT_TRUE(PositionTopic::read(subscriber.plankton, position, info));
+    TEST_ASSERT_EQUAL_INT16(3, position.x);
+    TEST_ASSERT_EQUAL_INT16(-4, position.y);
+    TEST_ASSERT_EQUAL_UINT32(1, info.count);
+    TEST_ASSERT_TRUE(info.stamped);
+
+    // A sample of another size is ignored - the value stays as it was.
+    const uint8_t other[] = {1, 2, 3};
+    TEST_ASSERT_TRUE(publisher.plankton.publish(PositionTopic::topic, other, sizeof(other)));
+    TEST_ASSERT_TRUE(subscriber.plankton.poll());
+    TEST_ASSERT_FALSE(PositionTopic::read(subscriber.plankton, position));
+    TEST_ASSERT_EQUAL_INT16(3, position.x);
+    TEST_ASSERT_EQUAL_INT16(-4, position.y);
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_multicast_reaches_only_subscribers);
+    RUN_TEST(test_broadcast_reaches_all);
+    RUN_TEST(test_budget_bounds_datagrams);
+    RUN_TEST(test_budget_bounds_time);
+    RUN_TEST(test_lost_reliable_packet_resent_until_acked);
+    RUN_TEST(test_reordering_within_window_counted);
+    RUN_TEST(test_batch_split_into_packets);
+    RUN_TEST(test_typed_topic_checks_size);
+    return UNITY_END();
+}
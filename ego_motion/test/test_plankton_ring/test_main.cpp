@@ -0,0 +1,96 @@
+// Tests of the ring between the network task and the control loop
+//
+// Copyright (c) 2022, Framework Labs.
+//
+// Run with: pio test -e native
+
+#include <plankton_ring.h>
+
+#include <unity.h>
+
+#include <atomic>
+#include <cstring>
+#include <string>
+#include <thread>
+
+// A small ring wraps around often and fills up whenever the reader falls behind.
+using Ring = PlanktonRing<8>;
+
+/// The datagram with the given index - its size and bytes both derive from the index.
+static size_t fillDatagram(uint32_t index, uint8_t* data) {
+    const auto size = 1 + index % PLANKTON_MAX_DATAGRAM;
+    for (size_t i = 0; i < size; ++i) {
+        data[i] = uint8_t(index + i);
+    }
+    return size;
+}
+
+void setUp() {}
+
+void tearDown() {}
+
+static void test_full_ring_rejects() {
+    Ring ring;
+    const uint8_t data[4] = {1, 2, 3, 4};
+    for (auto i = 0; i < 8; ++i) {
+        TEST_ASSERT_TRUE(ring.push(uint32_t(i), data, sizeof(data)));
+    }
+    TEST_ASSERT_FALSE(ring.push(8, data, sizeof(data)));
+
+    // Too small a buffer gets the start of the datagram and its full size.
+    uint8_t received[2];
+    auto size = size_t{};
+    auto addr = uint32_t{};
+    TEST_ASSERT_TRUE(ring.pop(received, sizeof(received), size, addr));
+    TEST_ASSERT_EQUAL_UINT32(0, addr);
+    TEST_ASSERT_EQUAL_UINT32(sizeof(data), size);
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(data, received, sizeof(received));
+    TEST_ASSERT_TRUE(ring.push(8, data, sizeof(data)));
+}
+
+static void test_concurrent_writer_and_reader() {
+    constexpr uint32_t datagrams = 1000000;
+
+    Ring ring;
+    std::atomic<uint32_t> rejected{0};
+    std::thread writer{[&ring, &rejected] {
+        uint8_t data[PLANKTON_MAX_DATAGRAM];
+        for (uint32_t index = 0; index < datagrams; ++index) {
+            const auto size = fillDatagram(index, data);
+            while (!ring.push(index, data, size)) {
+                rejected.fetch_add(1, std::memory_order_relaxed);
+                std::this_thread::yield();
+            }
+        }
+    }};
+
+    // Each datagram arrives once, in order and unharmed - a torn slot shows up as a wrong byte or size.
+    uint8_t expected[PLANKTON_MAX_DATAGRAM];
+    uint8_t received[PLANKTON_MAX_DATAGRAM];
+    auto mismatches = 0u;
+    for (uint32_t index = 0; index < datagrams;) {
+        auto size = size_t{};
+        auto addr = uint32_t{};
+        if (!ring.pop(received, sizeof(received), size, addr)) {
+            std::this_thread::yield();
+            continue;
+        }
+        const auto expectedSize = fillDatagram(index, expected);
+        if (addr != index || size != expectedSize || memcmp(received, expected, size) != 0) {
+            ++mismatches;
+        }
+        ++index;
+    }
+    writer.join();
+
+    TEST_ASSERT_EQUAL_UINT32(0, mismatches);
+    TEST_ASSERT_TRUE(ring.empty());
+    TEST_MESSAGE(("pushes rejected by the full ring: " + std::to_string(rejected.load())).c_str());
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_full_ring_rejects);
+    RUN_TEST(test_concurrent_writer_and_reader);
+    return UNITY_END();
+}
@@ -13,8 +13,24 @@
 
 #include <M5Atom.h>
 
+#ifdef EGO_RECORD
+#include <pa_record_sinks.h>
+#include <SPIFFS.h>
+#endif
+
 // Ranging Helpers
 
+// Set to the pin GPIO1 of the sensor is wired to, for ranges to be fetched on its data-ready interrupt.
+#ifndef RANGE_INT_PIN
+#define RANGE_INT_PIN -1
+#endif
+
+// Set to the XSHUT pins of several sensors - from left to right - to range with all of them at once.
+#ifdef RANGE_XSHUT_PINS
+static const int xshutPins[] = {RANGE_XSHUT_PINS};
+static_assert(sizeof(xshutPins) / sizeof(xshutPins[0]) <= MAX_RANGES, "too many sensors for the range message");
+#endif
+
 enum class IndicatorLevel : uint8_t {
     UNDEF = 0,
     NEAR,
@@ -49,38 +65,128 @@ pa_activity (RangeIndicator, pa_ctx(IndicatorLevel prevLevel), uint16_t range) {
     } pa_always_end;
 } pa_end;
 
-pa_activity (RangePublisher, pa_ctx(uint16_t prevRange), uint16_t range) {
-    while (true) {
-        Serial.printf("publishing range: %u\n", range);
-        plankton.publish(Topic::RANGE, (const uint8_t*)&range, 2);
-        pa_self.prevRange = range;
-        pa_await (range != pa_self.prevRange);
+// The nearest of the ranges to trust - `UNDEF_RANGE` if there is none.
+static uint16_t nearestRange(const FilteredRange* filtered) {
+    auto nearest = UNDEF_RANGE;
+    for (size_t i = 0; i < rangingSensors(); ++i) {
+        if (filtered[i].confidence >= MIN_RANGE_CONFIDENCE) {
+            nearest = min(nearest, filtered[i].range);
+        }
     }
+    return nearest;
+}
+
+pa_activity (RangePublisher, pa_ctx(Ranges ranges), const FilteredRange* filtered, bool cycle) {
+    // Publish stamped ranges as fast as the sensors measure them so that subscribers can detect stale values.
+    RangeTopic::advertise(plankton, {true, true, MOTION_CHANNEL, false});
+    pa_self.ranges = Ranges{uint8_t(rangingSensors()), {}, {}, {}, 0};
+    pa_always {
+        if (cycle) {
+            const auto now = millis();
+            auto oldest = now;
+            for (uint8_t i = 0; i < pa_self.ranges.count; ++i) {
+                pa_self.ranges.confidence[i] = filtered[i].confidence;
+                pa_self.ranges.mm[i] = filtered[i].range;
+                pa_self.ranges.rate[i] = filtered[i].rate;
+                if (int32_t(filtered[i].captureTime - oldest) < 0) {
+                    oldest = filtered[i].captureTime;
+                }
+            }
+            pa_self.ranges.age = uint16_t(min(now - oldest, uint32_t{UINT16_MAX}));
+            RangeTopic::publish(plankton, pa_self.ranges);
+        }
+    } pa_always_end;
+} pa_end;
+
+// Records the raw samples of each cycle, ahead of any filtering - only when built with EGO_RECORD.
+pa_activity (RangeRecorder, pa_ctx(), const RangeSample* samples, bool cycle) {
+#ifdef EGO_RECORD
+    pa_always {
+        if (cycle) {
+            inputRecorder.recordValue(RAW_RANGES, samples, rangingSensors() * sizeof(samples[0]));
+        }
+    } pa_always_end;
+#else
+    (void)samples;
+    (void)cycle;
+    pa_halt;
+#endif
+} pa_end;
+
+// Fast ranges while an obstacle is near, far reaching ones otherwise.
+static RangingProfile selectProfile(uint16_t range) {
+    return calcLevel(range) == IndicatorLevel::FAR ? RangingProfile::LONG_RANGE : RangingProfile::HIGH_SPEED;
+}
+
+// Switching costs a range, so only do it once this many ranges in a row asked for it.
+static constexpr unsigned PROFILE_VOTES = 3;
+
+pa_activity (ProfileSelector, pa_ctx(unsigned votes), uint16_t range, bool fresh) {
+    pa_self.votes = 0;
+    pa_always {
+        if (fresh) {
+            const auto profile = selectProfile(range);
+            if (profile == rangingProfile()) {
+                pa_self.votes = 0;
+            } else if (++pa_self.votes == PROFILE_VOTES) {
+                setRangingProfile(profile);
+                pa_self.votes = 0;
+            }
+        }
+    } pa_always_end;
 } pa_end;
 
+// Scheduling
+
+// Ranging runs at 50 Hz to keep up with the high-speed profile, the rest at 10 Hz.
+static auto scheduler = RateScheduler{20};
+static auto tickMonitor = TickMonitor{scheduler.basePeriod()};
+
+// The CPU runs at 80 MHz unless the tick load asks for more.
+static auto cpuGovernor = CpuGovernor{scheduler.basePeriod()};
+
 // Top-Level Activities
 
-pa_activity (RangeController, pa_ctx(uint16_t range; pa_co_res(4); pa_use(Ranger);
-                                     pa_use(RangeIndicator); pa_use(RangePublisher))) {
-    pa_co(3) {
-        pa_with (Ranger, pa_self.range);
-        pa_with (RangePublisher, pa_self.range);
-        pa_with (RangeIndicator, pa_self.range);
+// Raw samples go through a filter per sensor - all else only sees the filtered ones.
+pa_activity (RangeController, pa_ctx(RangeSample samples[MAX_RANGES]; FilteredRange filtered[MAX_RANGES]; bool cycle;
+                                     pa_co_res(6); pa_use(RangerArray); pa_use(RangeRecorder); pa_use(RangeFilters);
+                                     pa_use(RangeIndicator); pa_use(RangePublisher); pa_use(ProfileSelector))) {
+    pa_co(6) {
+        pa_with (RangerArray, pa_self.samples, pa_self.cycle);
+        pa_with (RangeRecorder, pa_self.samples, pa_self.cycle);
+        pa_with (RangeFilters, pa_self.samples, pa_self.cycle, pa_self.filtered);
+        pa_with (RangePublisher, pa_self.filtered, pa_self.cycle);
+        pa_with (RangeIndicator, nearestRange(pa_self.filtered));
+        pa_with (ProfileSelector, nearestRange(pa_self.filtered), pa_self.cycle);
     } pa_co_end;
 } pa_end;
 
-pa_activity (ModeController, pa_ctx(pa_use(RangeController); pa_use(BlinkLED)), Press press) {
+// The ranging runs in a tree of its own at the higher rate - the mode controller tells it when.
+
+static auto rangingOn = false;
+
+pa_activity (RangeMain, pa_ctx(pa_use(RangeController))) {
     while (true) {
-        pa_when_abort (press == Press::SHORT, RangeController);
+        pa_await (rangingOn);
+        pa_when_abort (!rangingOn, RangeController);
         stopRanging();
+    }
+} pa_end;
+
+pa_activity (ModeController, pa_ctx(pa_use(BlinkLED)), Press press) {
+    while (true) {
+        rangingOn = true;
+        pa_await (press == Press::SHORT);
+        rangingOn = false;
 
         pa_when_abort (press == Press::SHORT, BlinkLED, CRGB::White, 5, 10);
     }
 } pa_end;
 
-pa_activity (Main, pa_ctx(pa_co_res(2); Press press;
+pa_activity (Main, pa_ctx(pa_co_res(5); Press press;
                           pa_use(BlinkLED); pa_use(Connector); 
-                          pa_use(PressRecognizer); pa_use(ModeController)), 
+                          pa_use(PressRecognizer); pa_use(ModeController); pa_use_as(TopicPublisher, Stats);
+                          pa_use_as(TopicPublisher, Ticks); pa_use(TickLogger)), 
                    bool setupOK) {
     if (!setupOK) {
         pa_run (BlinkLED, CRGB::Red, 10, 10);
@@ -92,25 +198,54 @@ pa_activity (Main, pa_ctx(pa_co_res(2); Press press;
     } pa_co_end;
     clearLED();
 
-    pa_co(2) {
+    pa_co(5) {
         pa_with (PressRecognizer, M5.Btn, pa_self.press);
         pa_with (ModeController, pa_self.press);
+        pa_with_as (TopicPublisher, Stats, RangerDiagnosticsTopic{}, plankton.stats(), 50);
+        pa_with_as (TopicPublisher, Ticks, RangerTicksTopic{}, tickMonitor.stats(), 50);
+        pa_with (TickLogger, tickMonitor, 100);
     } pa_co_end;
 } pa_end;
 
 // Setup and Loop
 
 static pa_use(Main);
+static pa_use(RangeMain);
 static bool setupOK = false;
 
 void setup() {
-    setCpuFrequencyMhz(80);
+    setCpuFrequencyMhz(cpuGovernor.frequencyMhz());
+    tickMonitor.setGovernor(&cpuGovernor);
 
     M5.begin();
 
     initLED();
+
+    plankton.setBatching(true);
+
+    // The button gets updated along with Main only so that it does not miss an edge in between.
+    scheduler.add([] { M5.update(); pa_tick(Main, setupOK); }, 5);
+    scheduler.add([] { pa_tick(RangeMain); }, 1);
+
+#ifdef EGO_RECORD
+    // Record the raw ranges, the button and the datagrams of every tick - on SPIFFS if EGO_RECORD is 2,
+    // on Serial otherwise.
+#if EGO_RECORD == 2
+    SPIFFS.begin(true);
+    static auto recordSink = FileRecordSink{SPIFFS.open("/inputs.rec", FILE_WRITE)};
+#else
+    static auto recordSink = SerialRecordSink{};
+#endif
+    inputRecorder.begin(recordSink, RANGER_NODE);
+#endif
     
-    if (!initRanging(19, 22)) {
+#ifdef RANGE_XSHUT_PINS
+    const auto rangingOK = initRangingArray(19, 22, xshutPins, sizeof(xshutPins) / sizeof(xshutPins[0]),
+                                            RangingProfile::HIGH_SPEED);
+#else
+    const auto rangingOK = initRanging(19, 22, RANGE_INT_PIN, RangingProfile::HIGH_SPEED);
+#endif
+    if (!rangingOK) {
         return;
     }
 
@@ -121,11 +256,21 @@ void loop() {
     TickType_t prevWakeTime = xTaskGetTickCount();
 
     while (true) {
-        M5.update();
+        tickMonitor.beginTick();
+#ifdef EGO_RECORD
+        inputRecorder.beginTick(millis());
+#endif
+
+        scheduler.tick();
+
+        plankton.flush();
 
-        pa_tick(Main, setupOK);
+#ifdef EGO_RECORD
+        inputRecorder.recordButtons(uint8_t(M5.Btn.isPressed()));
+        inputRecorder.endTick();
+#endif
+        tickMonitor.endTick();
 
-        // We run at 10 Hz.
-        vTaskDelayUntil(&prevWakeTime, 100);
+        vTaskDelayUntil(&prevWakeTime, scheduler.basePeriod());
     }
 }
@@ -12,6 +12,11 @@
 
 #include <M5StickC.h>
 
+#ifdef EGO_RECORD
+#include <pa_record_sinks.h>
+#include <SPIFFS.h>
+#endif
+
 // Screen
 
 static TFT_eSprite screen{&M5.Lcd};
@@ -47,9 +52,9 @@ static constexpr auto DIMMER_CONFIG = DimmerConfig{10, 50, 5};
 // Input/Output Helpers
 
 pa_activity (IntentSubscriber, pa_ctx(), Intent& intent) {
-    plankton.subscribe(Topic::INTENT, {});
+    IntentTopic::subscribe(plankton, {});
     pa_always {
-        plankton.read(Topic::INTENT, (uint8_t*)&intent, 1);
+        IntentTopic::read(plankton, intent);
     } pa_always_end;
 } pa_end;
 
@@ -66,9 +71,10 @@ pa_activity (IntentChangeDetector, pa_ctx(Intent prevIntent), Intent intent, boo
 } pa_end;
 
 pa_activity (PressPublisher, pa_ctx(Press prevPress), Press press) {
+    PressTopic::advertise(plankton, {false, true, MOTION_CHANNEL, true});
     while (true) { 
         Serial.printf("pub press: %u\n", (uint8_t)press);
-        plankton.publish(Topic::PRESS, (const uint8_t*)&press, 1);
+        PressTopic::publish(plankton, press);
         pa_self.prevPress = press;
         pa_await (press != pa_self.prevPress);
     }
@@ -98,6 +104,21 @@ pa_activity (JoystickReader, pa_ctx(), int8_t& x, int8_t& y, bool& btn) {
     } pa_always_end;
 } pa_end;
 
+// Records the joystick as read - only when built with EGO_RECORD.
+pa_activity (JoystickRecorder, pa_ctx(), int8_t x, int8_t y, bool btn) {
+#ifdef EGO_RECORD
+    pa_always {
+        const int8_t values[] = {x, y, int8_t(btn)};
+        inputRecorder.recordValue(RAW_JOYSTICK, values, sizeof(values));
+    } pa_always_end;
+#else
+    (void)x;
+    (void)y;
+    (void)btn;
+    pa_halt;
+#endif
+} pa_end;
+
 pa_activity (JoystickLogger, pa_ctx(), int8_t x, int8_t y, bool btn) {
     pa_always {
         Serial.printf("x: %d\n", x);
@@ -106,19 +127,14 @@ pa_activity (JoystickLogger, pa_ctx(), int8_t x, int8_t y, bool btn) {
     } pa_always_end;
 } pa_end;
 
-pa_activity (JoystickPublisher, pa_ctx(int8_t prevX; int8_t prevY; uint8_t prevBtn), int8_t x, int8_t y, bool btn) {
+// Publishes on change and repeats a speed other than zero on every tick - ego_motion stops on a stale speed.
+pa_activity (JoystickPublisher, pa_ctx(int8_t prevX; int8_t prevY), int8_t x, int8_t y) {
+    JoystickTopic::advertise(plankton, {true, true, MOTION_CHANNEL, false});
     while (true) { 
-        {
-            uint8_t buf[3];
-            buf[0] = x;
-            buf[1] = y;
-            buf[2] = btn;
-            plankton.publish(Topic::JOYSTICK, buf, 3);
-        }
+        JoystickTopic::publish(plankton, Speed{x, y});
         pa_self.prevX = x;
         pa_self.prevY = y;
-        pa_self.prevBtn = btn;
-        pa_await (x != pa_self.prevX || y != pa_self.prevY || btn != pa_self.prevBtn);
+        pa_await (x != pa_self.prevX || y != pa_self.prevY || x != 0 || y != 0);
     }
 } pa_end;
 
@@ -181,7 +197,7 @@ pa_activity (ManualScreen, pa_ctx(pa_co_res(2); pa_use(JoystickPublisher); pa_us
     drawBorder(GREEN);
 
     pa_co(2) {
-        pa_with (JoystickPublisher, joyX, joyY, false);
+        pa_with (JoystickPublisher, joyX, joyY);
         pa_with (JoystickLogger, joyX, joyY, false);
     } pa_co_end;    
 } pa_end;
@@ -216,7 +232,20 @@ pa_activity (QuitScreen, pa_ctx(pa_use(Delay))) {
     }
 } pa_end;
 
-pa_activity (MainScreen, pa_ctx(pa_use(StopScreen); pa_use(QuitScreen); pa_use(ManualScreen); pa_use(AutoScreen)), Intent intent, int8_t joyX, int8_t joyY) {
+pa_activity (CalibrateScreen, pa_ctx()) {
+    screen.fillSprite(WHITE);
+    screen.setTextColor(BLACK);
+
+    screen.setCursor(20, 75, 2);
+    screen.print("CALIB");
+
+    drawBorder(PURPLE);
+
+    pa_halt;
+} pa_end;
+
+pa_activity (MainScreen, pa_ctx(pa_use(StopScreen); pa_use(QuitScreen); pa_use(ManualScreen); pa_use(AutoScreen);
+                                pa_use(CalibrateScreen)), Intent intent, int8_t joyX, int8_t joyY) {
     while (true) {
         if (intent == Intent::STOP) {
             pa_when_abort(intent != Intent::STOP, StopScreen);
@@ -230,17 +259,30 @@ pa_activity (MainScreen, pa_ctx(pa_use(StopScreen); pa_use(QuitScreen); pa_use(M
         if (intent == Intent::QUIT) {
             pa_when_abort (intent != Intent::QUIT, QuitScreen);
         }
+        if (intent == Intent::CALIBRATE) {
+            pa_when_abort (intent != Intent::CALIBRATE, CalibrateScreen);
+        }
     }
 } pa_end;
 
+// Scheduling
+
+// We run at 10 Hz.
+static auto scheduler = RateScheduler{100};
+static auto tickMonitor = TickMonitor{scheduler.basePeriod()};
+
+// The CPU runs at 80 MHz unless drawing the screen takes up too much of the tick.
+static auto cpuGovernor = CpuGovernor{scheduler.basePeriod()};
+
 // Main Activity
 
-pa_activity (Main, pa_ctx(pa_co_res(10); Press rawPress; Press press; Intent intent; bool intentChanged;
+pa_activity (Main, pa_ctx(pa_co_res(13); Press rawPress; Press press; Intent intent; bool intentChanged;
                           int8_t joyX; int8_t joyY; bool rawStopButton; bool stopButton;
-                          pa_use(ErrorScreen); pa_use(PressRecognizer2); pa_use(JoystickReader);
+                          pa_use(ErrorScreen); pa_use(PressRecognizer2); pa_use(JoystickReader); pa_use(JoystickRecorder);
                           pa_use(ConnectorScreen); pa_use(MainScreen); pa_use(InputCombiner);
                           pa_use(Connector); pa_use(Dimmer); pa_use(PressPublisher); pa_use(IntentChangeDetector);
-                          pa_use(Receiver); pa_use(IntentSubscriber); pa_use(RaisingEdgeDetector)),
+                          pa_use(Receiver); pa_use(IntentSubscriber); pa_use(RaisingEdgeDetector);
+                          pa_use(TopicPublisher); pa_use(TickLogger)),
                    bool setupOK) {
     if (!setupOK) {
         pa_run (ErrorScreen);
@@ -251,10 +293,11 @@ pa_activity (Main, pa_ctx(pa_co_res(10); Press rawPress; Press press; Intent int
         pa_with_weak (ConnectorScreen);
     } pa_co_end;
 
-    pa_co(10) {
+    pa_co(13) {
         pa_with (Receiver);
         pa_with (IntentSubscriber, pa_self.intent);
         pa_with (JoystickReader, pa_self.joyX, pa_self.joyY, pa_self.rawStopButton);
+        pa_with (JoystickRecorder, pa_self.joyX, pa_self.joyY, pa_self.rawStopButton);
         pa_with (MainScreen, pa_self.intent, pa_self.joyX, pa_self.joyY);
         pa_with (PressRecognizer2, M5.BtnA, M5.BtnB, pa_self.rawPress);
         pa_with (IntentChangeDetector, pa_self.intent, pa_self.intentChanged);
@@ -262,6 +305,8 @@ pa_activity (Main, pa_ctx(pa_co_res(10); Press rawPress; Press press; Intent int
         pa_with (RaisingEdgeDetector, pa_self.rawStopButton, pa_self.stopButton);
         pa_with (InputCombiner, pa_self.stopButton, pa_self.intent, pa_self.press);
         pa_with (PressPublisher, pa_self.press);
+        pa_with (TopicPublisher, RemoteTicksTopic{}, tickMonitor.stats(), 50);
+        pa_with (TickLogger, tickMonitor, 100);
     } pa_co_end;
 } pa_end;
 
@@ -271,11 +316,28 @@ static pa_use(Main);
 static bool setupOK;
 
 void setup() {
-    setCpuFrequencyMhz(80);
+    setCpuFrequencyMhz(cpuGovernor.frequencyMhz());
+    tickMonitor.setGovernor(&cpuGovernor);
 
     M5.begin();
 
     initDisplay();
+
+    plankton.setBatching(true);
+
+    scheduler.add([] { pa_tick(Main, setupOK); }, 1);
+
+#ifdef EGO_RECORD
+    // Record the buttons, the joystick and the datagrams of every tick - on SPIFFS if EGO_RECORD is 2,
+    // on Serial otherwise.
+#if EGO_RECORD == 2
+    SPIFFS.begin(true);
+    static auto recordSink = FileRecordSink{SPIFFS.open("/inputs.rec", FILE_WRITE)};
+#else
+    static auto recordSink = SerialRecordSink{};
+#endif
+    inputRecorder.begin(recordSink, REMOTE_NODE);
+#endif
     
     if (!Wire.begin(0, 26)) {
         Serial.println("Init Wire failed");
@@ -285,17 +347,35 @@ void setup() {
     setupOK = true;
 }
 
+#ifdef EGO_RECORD
+static uint8_t buttonMask() {
+    return uint8_t(M5.BtnA.isPressed() | M5.BtnB.isPressed() << 1);
+}
+#endif
+
 void loop() {
     TickType_t prevWakeTime = xTaskGetTickCount();
 
     while (true) {
+        tickMonitor.beginTick();
+#ifdef EGO_RECORD
+        inputRecorder.beginTick(millis());
+#endif
+
         M5.update();
 
-        pa_tick(Main, setupOK);
+        scheduler.tick();
+
+        plankton.flush();
 
         displayIfNeeded();
 
-        // We run at 10 Hz.
-        vTaskDelayUntil(&prevWakeTime, 100);
+#ifdef EGO_RECORD
+        inputRecorder.recordButtons(buttonMask());
+        inputRecorder.endTick();
+#endif
+        tickMonitor.endTick();
+
+        vTaskDelayUntil(&prevWakeTime, scheduler.basePeriod());
     }
 }